@@ -0,0 +1,404 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "common/types.h"
+#include "common/utils.h"
+#include "storage/sd/fatfs/ff.h"
+#include "storage/nand/nand.h"
+#include "storage/nand/image.h"
+#include "storage/nand/ecc.h"
+#include "crypto/sha.h"
+#include "video/console.h"
+#include "backup.h"
+
+/* one block is read from nand while the previous one is written to sd */
+#define BACKUP_CHUNK_PAGES  BLOCK_PAGES
+#define BACKUP_CHUNK_SIZE   (BACKUP_CHUNK_PAGES * IMAGE_PAGE_SIZE)
+#define BACKUP_CHUNKS       (PAGE_COUNT / BACKUP_CHUNK_PAGES)
+
+static u8 backup_buf[2][BACKUP_CHUNK_SIZE] ALIGNED(64);
+static u8 restore_img[BACKUP_CHUNK_SIZE] ALIGNED(64);
+static u8 restore_pg[BLOCK_PAGES][PAGE_SIZE] ALIGNED(64), restore_sp[BLOCK_PAGES][SPARE_SIZE];
+static u8 restore_cmp[2][PAGE_SIZE] ALIGNED(64);
+
+static int backup_save_hash(const char *path, const u8 *hash)
+{
+    char sha_path[0x40];
+    UINT bw = 0;
+    FIL fil;
+    int rc = 0;
+
+    snprintf(sha_path, sizeof(sha_path), "%s.sha", path);
+    if (f_open(&fil, sha_path, FA_WRITE | FA_CREATE_ALWAYS))
+        return -1;
+    if (f_write(&fil, hash, SHA_HASH_SIZE, &bw) || (bw != SHA_HASH_SIZE))
+        rc = -2;
+    f_close(&fil);
+
+    return rc;
+}
+
+int backup_bank(u32 bank, const char *path)
+{
+    u8 hash[SHA_HASH_SIZE];
+    sha_ctx sha;
+    UINT bw = 0;
+    FIL fil;
+    int rc = 0;
+    u32 c;
+
+    /* never overwrite an existing backup */
+    if (f_open(&fil, path, FA_WRITE | FA_CREATE_NEW)) {
+        printf(CONSOLE_RED "Cannot create %s, delete any previous backup first\n" CONSOLE_RESET, path);
+        return -1;
+    }
+
+    /* allocate the whole file upfront so it doesn't grow a cluster at a time */
+    if (f_lseek(&fil, IMAGE_SIZE) || (f_tell(&fil) != IMAGE_SIZE) || f_lseek(&fil, 0)) {
+        printf(CONSOLE_RED "Not enough space on the sd card for %s\n" CONSOLE_RESET, path);
+        rc = -2;
+        goto out;
+    }
+
+    sha_init(&sha);
+    if (nand_batch_begin(bank, 0) < 0) {
+        rc = -3;
+        goto out_nand;
+    }
+
+    if (nand_bg_read_start(0, BACKUP_CHUNK_PAGES, backup_buf[0]) < 0) {
+        rc = -3;
+        goto out_nand;
+    }
+
+    for (c = 0; c < BACKUP_CHUNKS; c++) {
+        u8 *chunk = backup_buf[c & 1];
+
+        if (nand_bg_read_wait() < 0) {
+            printf(CONSOLE_RED "\nFailed to read nand block %lu\n" CONSOLE_RESET, c);
+            rc = -3;
+            goto out_nand;
+        }
+
+        /* read the next block while this one is hashed and written */
+        if (((c + 1) < BACKUP_CHUNKS) &&
+            (nand_bg_read_start((c + 1) * BACKUP_CHUNK_PAGES, BACKUP_CHUNK_PAGES, backup_buf[(c + 1) & 1]) < 0)) {
+            rc = -3;
+            goto out_nand;
+        }
+
+        sha_update(&sha, chunk, BACKUP_CHUNK_SIZE);
+
+        if (f_write(&fil, chunk, BACKUP_CHUNK_SIZE, &bw) || (bw != BACKUP_CHUNK_SIZE)) {
+            printf(CONSOLE_RED "\nFailed to write %s\n" CONSOLE_RESET, path);
+            nand_bg_read_wait();
+            rc = -4;
+            goto out_nand;
+        }
+
+        if (!(c % 64))
+            printf("\r%s: %lu%%", path, (c * 100) / BACKUP_CHUNKS);
+    }
+    printf("\r%s: 100%%\n", path);
+
+    sha_final(&sha, hash);
+
+out_nand:
+    nand_batch_end();
+out:
+    f_close(&fil);
+
+    if (rc < 0) {
+        /* don't leave a partial dump behind that looks like a backup */
+        f_unlink(path);
+        return rc;
+    }
+
+    if (backup_save_hash(path, hash) < 0) {
+        printf(CONSOLE_RED "Failed to write %s.sha\n" CONSOLE_RESET, path);
+        return -5;
+    }
+
+    return 0;
+}
+
+int backup_nand(void)
+{
+    int rc;
+
+    puts("Backing up SLC");
+    rc = backup_bank(BANK_SLC, "slc.raw");
+    if (rc < 0)
+        return rc;
+
+    puts("Backing up SLCCMPT");
+    rc = backup_bank(BANK_SLCCMPT, "slccmpt.raw");
+    if (rc < 0)
+        return rc;
+
+    puts(CONSOLE_GREEN "\nBackup complete." CONSOLE_RESET);
+    return 0;
+}
+
+static bool restore_equal(const void *a, const void *b, u32 size)
+{
+    const u32 *wa = a, *wb = b;
+
+    for (size /= 4; size > 0; size--)
+        if (*wa++ != *wb++)
+            return false;
+
+    return true;
+}
+
+static bool restore_page_erased(const u8 *page)
+{
+    const u32 *w = (const u32 *)page;
+
+    for (u32 i = 0; i < IMAGE_PAGE_SIZE / 4; i++)
+        if (w[i] != 0xffffffff)
+            return false;
+
+    return true;
+}
+
+/* ecc correct a copy of the data of a raw page */
+static int restore_page_correct(u8 *out, const u8 *page)
+{
+    u8 ecc[ECC_PAGE_SIZE] ALIGNED(4);
+
+    memcpy(out, page, PAGE_SIZE);
+    nand_ecc_calc(out, ecc);
+    return nand_ecc_correct(out, page + PAGE_SIZE + ECC_SPARE_OFFS, ecc, NULL);
+}
+
+/* compare a raw block with its image after ecc correction, so bitflips the
+ * ecc fixes anyway don't count as differences; an uncorrectable image page
+ * is compared as it is since that's what would be written */
+static bool restore_block_equal(const u8 *nand, const u8 *img)
+{
+    for (u32 p = 0; p < BLOCK_PAGES; p++) {
+        const u8 *np = nand + p * IMAGE_PAGE_SIZE;
+        const u8 *ip = img + p * IMAGE_PAGE_SIZE;
+
+        if (restore_equal(np, ip, IMAGE_PAGE_SIZE))
+            continue;
+
+        if (restore_page_correct(restore_cmp[0], np) < 0)
+            return false;
+        restore_page_correct(restore_cmp[1], ip);
+
+        /* the spare ahead of the stored ecc isn't covered by it */
+        if (!restore_equal(restore_cmp[0], restore_cmp[1], PAGE_SIZE) ||
+            !restore_equal(np + PAGE_SIZE, ip + PAGE_SIZE, ECC_SPARE_OFFS))
+            return false;
+    }
+
+    return true;
+}
+
+static int restore_open(restore_plan *plan, FIL *fil)
+{
+    if (f_open(fil, plan->path, FA_READ)) {
+        printf(CONSOLE_RED "Cannot open %s\n" CONSOLE_RESET, plan->path);
+        return -1;
+    }
+    if (f_size(fil) != IMAGE_SIZE) {
+        printf(CONSOLE_RED "%s is not a nand backup\n" CONSOLE_RESET, plan->path);
+        f_close(fil);
+        return -2;
+    }
+    return 0;
+}
+
+int restore_scan(restore_plan *plan)
+{
+    u8 hash[SHA_HASH_SIZE], saved_hash[SHA_HASH_SIZE];
+    char sha_path[0x40];
+    sha_ctx sha;
+    UINT br = 0;
+    FIL fil;
+    int rc = 0;
+    u32 c;
+
+    memset(plan->diff, 0, sizeof(plan->diff));
+    plan->count = 0;
+
+    snprintf(sha_path, sizeof(sha_path), "%s.sha", plan->path);
+    if (f_open(&fil, sha_path, FA_READ) ||
+        f_read(&fil, saved_hash, SHA_HASH_SIZE, &br) || (br != SHA_HASH_SIZE)) {
+        printf(CONSOLE_RED "Cannot read %s\n" CONSOLE_RESET, sha_path);
+        f_close(&fil);
+        return -1;
+    }
+    f_close(&fil);
+
+    rc = restore_open(plan, &fil);
+    if (rc < 0)
+        return rc;
+
+    sha_init(&sha);
+    if (nand_batch_begin(plan->bank, 0) < 0) {
+        rc = -3;
+        goto out;
+    }
+
+    if (nand_bg_read_start(0, BLOCK_PAGES, backup_buf[0]) < 0) {
+        rc = -3;
+        goto out;
+    }
+
+    for (c = 0; c < BLOCK_COUNT; c++) {
+        u8 *nand = backup_buf[c & 1];
+
+        /* the sd read runs while the nand block is being read */
+        if (f_read(&fil, restore_img, BACKUP_CHUNK_SIZE, &br) || (br != BACKUP_CHUNK_SIZE)) {
+            printf(CONSOLE_RED "\nFailed to read %s\n" CONSOLE_RESET, plan->path);
+            nand_bg_read_wait();
+            rc = -4;
+            goto out;
+        }
+
+        if (nand_bg_read_wait() < 0) {
+            printf(CONSOLE_RED "\nFailed to read nand block %lu\n" CONSOLE_RESET, c);
+            rc = -3;
+            goto out;
+        }
+
+        if (((c + 1) < BLOCK_COUNT) &&
+            (nand_bg_read_start((c + 1) * BLOCK_PAGES, BLOCK_PAGES, backup_buf[(c + 1) & 1]) < 0)) {
+            rc = -3;
+            goto out;
+        }
+
+        sha_update(&sha, restore_img, BACKUP_CHUNK_SIZE);
+
+        /* leave factory bad blocks alone */
+        if ((nand[PAGE_SIZE] != 0xff) || (nand[IMAGE_PAGE_SIZE + PAGE_SIZE] != 0xff))
+            continue;
+
+        if (!restore_block_equal(nand, restore_img)) {
+            plan->diff[c / 32] |= 1u << (c % 32);
+            plan->count++;
+        }
+
+        if (!(c % 64))
+            printf("\rComparing %s: %lu%%", plan->path, (c * 100) / BLOCK_COUNT);
+    }
+    printf("\rComparing %s: 100%%\n", plan->path);
+
+    sha_final(&sha, hash);
+    if (memcmp(hash, saved_hash, SHA_HASH_SIZE)) {
+        printf(CONSOLE_RED "%s doesn't match %s\n" CONSOLE_RESET, plan->path, sha_path);
+        rc = -5;
+    }
+
+out:
+    nand_batch_end();
+    f_close(&fil);
+
+    if (rc < 0) {
+        memset(plan->diff, 0, sizeof(plan->diff));
+        plan->count = 0;
+    }
+    return rc;
+}
+
+static int restore_block(u32 blockno, u8 *img)
+{
+    u64 erased = 0;
+    u32 p, n;
+
+    /* split the image into the page and spare layout of the nand api */
+    for (p = 0; p < BLOCK_PAGES; p++) {
+        const u8 *page = img + p * IMAGE_PAGE_SIZE;
+
+        if (restore_page_erased(page))
+            erased |= 1ULL << p;
+
+        memcpy(restore_pg[p], page, PAGE_SIZE);
+        memcpy(restore_sp[p], page + PAGE_SIZE, SPARE_SIZE);
+    }
+
+    if (nand_erase_block(blockno) < 0)
+        return -1;
+
+    /* program runs of written pages, erased ones are already erased */
+    for (p = 0; p < BLOCK_PAGES; p += n) {
+        n = 1;
+        if (erased & (1ULL << p))
+            continue;
+
+        while (((p + n) < BLOCK_PAGES) && !(erased & (1ULL << (p + n))))
+            n++;
+
+        if (nand_write_pages(blockno * BLOCK_PAGES + p, n, restore_pg[p], restore_sp[p]) < 0)
+            return -2;
+    }
+
+    /* read back and compare with the image */
+    if ((nand_bg_read_start(blockno * BLOCK_PAGES, BLOCK_PAGES, backup_buf[0]) < 0) ||
+        (nand_bg_read_wait() < 0))
+        return -3;
+
+    if (!restore_block_equal(backup_buf[0], img))
+        return -4;
+
+    return 0;
+}
+
+int restore_apply(restore_plan *plan)
+{
+    UINT br = 0;
+    FIL fil;
+    int rc, failed = 0;
+    u32 c, done = 0;
+
+    if (!plan->count)
+        return 0;
+
+    rc = restore_open(plan, &fil);
+    if (rc < 0)
+        return rc;
+
+    if (nand_batch_begin(plan->bank, 1) < 0) {
+        nand_batch_end();
+        f_close(&fil);
+        return -3;
+    }
+
+    for (c = 0; c < BLOCK_COUNT; c++) {
+        if (!(plan->diff[c / 32] & (1u << (c % 32))))
+            continue;
+
+        printf("\rRestoring %s: block %lu (%lu/%lu)", plan->path, c, ++done, plan->count);
+
+        if (f_lseek(&fil, c * BACKUP_CHUNK_SIZE) ||
+            f_read(&fil, restore_img, BACKUP_CHUNK_SIZE, &br) || (br != BACKUP_CHUNK_SIZE)) {
+            printf(CONSOLE_RED "\nFailed to read %s\n" CONSOLE_RESET, plan->path);
+            failed = -1;
+            break;
+        }
+
+        rc = restore_block(c, restore_img);
+        if (rc < 0) {
+            printf(CONSOLE_RED "\nFailed to restore block %lu (%d)\n" CONSOLE_RESET, c, rc);
+            failed = -2;
+            continue;
+        }
+
+        plan->diff[c / 32] &= ~(1u << (c % 32));
+    }
+    printf("\n");
+
+    nand_batch_end();
+    f_close(&fil);
+
+    return failed;
+}
@@ -0,0 +1,36 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _BACKUP_H_
+#define _BACKUP_H_
+
+#include "common/types.h"
+#include "storage/nand/nand.h"
+
+/* dump a nand bank (pages followed by their spare) to a file on the sd
+ * card, along with its sha1 in <path>.sha */
+int backup_bank(u32 bank, const char *path);
+
+/* dump slc and slccmpt to slc.raw and slccmpt.raw */
+int backup_nand(void);
+
+/* differential restore of a nand bank from a backup */
+typedef struct restore_plan {
+    u32 bank;
+    const char *path;
+    u32 diff[BLOCK_COUNT / 32];  // blocks that differ from the backup
+    u32 count;
+} restore_plan;
+
+/* compare a bank with its backup (verifying the backup sha1) and fill
+ * in the blocks to restore, nothing is written */
+int restore_scan(restore_plan *plan);
+
+/* erase and program the blocks found by restore_scan, verifying them */
+int restore_apply(restore_plan *plan);
+
+#endif
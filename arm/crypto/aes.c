@@ -1,4 +1,5 @@
 #include "aes.h"
+#include "aes_sw.h"
 #include "system/latte.h"
 #include "common/utils.h"
 #include "system/memory.h"
@@ -8,22 +9,33 @@
 #define     AES_CMD_RESET   0
 #define     AES_CMD_ENCRYPT 0x9000
 #define     AES_CMD_DECRYPT 0x9800
+#define     AES_CMD_IRQ     0x4000
 
-static inline void aes_command(u16 cmd, u8 iv_keep, u32 blocks)
+#define     AES_CTRL_EXEC   0x80000000
+#define     AES_CTRL_ERR    0x20000000
+
+#define     AES_MAX_BLOCKS  0x80
+
+static int aes_backend = AES_BACKEND_HW;
+
+/* queue of asynchronous requests, the head is running on the engine */
+static aes_req * volatile aes_queue_head = NULL;
+static aes_req * volatile aes_queue_tail = NULL;
+
+static inline void aes_start(u16 cmd, u8 iv_keep, u32 blocks)
 {
     if (blocks != 0)
         blocks--;
     write32(AES_CTRL, (cmd << 16) | (iv_keep ? 0x1000 : 0) | (blocks&0x7f));
-    while (read32(AES_CTRL) & 0x80000000);
 }
 
-void aes_reset(void)
+static inline void aes_command(u16 cmd, u8 iv_keep, u32 blocks)
 {
-    write32(AES_CTRL, 0);
-    while (read32(AES_CTRL) != 0);
+    aes_start(cmd, iv_keep, blocks);
+    while (read32(AES_CTRL) & AES_CTRL_EXEC);
 }
 
-void aes_set_iv(u8 *iv)
+static void aes_load_iv(u8 *iv)
 {
     int i;
     for(i = 0; i < 4; i++) {
@@ -32,9 +44,161 @@ void aes_set_iv(u8 *iv)
     }
 }
 
+static void aes_run_chunk(aes_req *req)
+{
+    u32 offs = (req->blocks - req->remaining) * AES_BLOCK_SIZE;
+    u32 this_blocks = min(req->remaining, AES_MAX_BLOCKS);
+
+    write32(AES_SRC, dma_addr(req->src + offs));
+    write32(AES_DEST, dma_addr(req->dst + offs));
+
+    aes_start((req->decrypt ? AES_CMD_DECRYPT : AES_CMD_ENCRYPT) | AES_CMD_IRQ,
+              offs ? 1 : req->keep_iv, this_blocks);
+}
+
+static void aes_run_next(void)
+{
+    aes_req *req = aes_queue_head;
+
+    if (!req) {
+        irq_disable(IRQ_AES);
+        return;
+    }
+
+    if (req->iv)
+        aes_load_iv(req->iv);
+
+    ahb_flush_to(RB_AES);
+    aes_run_chunk(req);
+}
+
+void aes_irq(void)
+{
+    aes_req *req = aes_queue_head;
+    if (!req)
+        return;
+
+    if (read32(AES_CTRL) & AES_CTRL_ERR) {
+        req->status = AES_REQ_ERROR;
+    } else {
+        req->remaining -= min(req->remaining, AES_MAX_BLOCKS);
+        if (req->remaining) {
+            aes_run_chunk(req);
+            return;
+        }
+        req->status = AES_REQ_DONE;
+    }
+
+    ahb_flush_from(WB_AES);
+    ahb_flush_to(RB_IOD);
+
+    aes_queue_head = req->next;
+    if (!aes_queue_head)
+        aes_queue_tail = NULL;
+
+    if (req->done)
+        req->done(req);
+
+    aes_run_next();
+}
+
+void aes_submit(aes_req *req)
+{
+    u32 cookie;
+
+    /* the software backend completes requests right away */
+    if (aes_backend == AES_BACKEND_SW) {
+        if (req->iv)
+            aes_sw_set_iv(req->iv);
+        if (req->decrypt)
+            aes_sw_decrypt(req->src, req->dst, req->blocks, req->keep_iv);
+        else
+            aes_sw_encrypt(req->src, req->dst, req->blocks, req->keep_iv);
+        req->remaining = 0;
+        req->status = AES_REQ_DONE;
+        if (req->done)
+            req->done(req);
+        return;
+    }
+
+    dc_flushrange(req->src, req->blocks * AES_BLOCK_SIZE);
+    dc_invalidaterange(req->dst, req->blocks * AES_BLOCK_SIZE);
+
+    req->status = AES_REQ_PENDING;
+    req->remaining = req->blocks;
+    req->next = NULL;
+
+    cookie = irq_kill();
+    if (aes_queue_tail) {
+        aes_queue_tail->next = req;
+        aes_queue_tail = req;
+    } else {
+        aes_queue_head = aes_queue_tail = req;
+        irq_enable(IRQ_AES);
+        aes_run_next();
+    }
+    irq_restore(cookie);
+}
+
+int aes_wait(aes_req *req)
+{
+    while (req->status == AES_REQ_PENDING) {
+        u32 cookie = irq_kill();
+        if (req->status == AES_REQ_PENDING) {
+            irq_wait();
+        }
+        irq_restore(cookie);
+    }
+
+    return req->status;
+}
+
+void aes_sync(void)
+{
+    aes_req *req;
+
+    while ((req = aes_queue_tail))
+        aes_wait(req);
+}
+
+void aes_set_backend(int backend)
+{
+    aes_sync();
+    aes_backend = backend;
+}
+
+int aes_get_backend(void)
+{
+    return aes_backend;
+}
+
+void aes_reset(void)
+{
+    aes_sync();
+    if (aes_backend == AES_BACKEND_SW)
+        return;
+    write32(AES_CTRL, 0);
+    while (read32(AES_CTRL) != 0);
+}
+
+void aes_set_iv(u8 *iv)
+{
+    if (aes_backend == AES_BACKEND_SW) {
+        aes_sw_set_iv(iv);
+        return;
+    }
+    aes_sync();
+    aes_load_iv(iv);
+}
+
 void aes_empty_iv(void)
 {
     int i;
+    if (aes_backend == AES_BACKEND_SW) {
+        aes_sw_empty_iv();
+        return;
+    }
+    aes_sync();
     for(i = 0; i < 4; i++)
         write32(AES_IV, 0);
 }
@@ -42,6 +206,11 @@ void aes_empty_iv(void)
 void aes_set_key(u8 *key)
 {
     int i;
+    if (aes_backend == AES_BACKEND_SW) {
+        aes_sw_set_key(key);
+        return;
+    }
+    aes_sync();
     for(i = 0; i < 4; i++) {
         write32(AES_KEY, *(u32 *)key);
         key += 4;
@@ -50,6 +219,11 @@ void aes_set_key(u8 *key)
 
 void aes_decrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
 {
+    if (aes_backend == AES_BACKEND_SW) {
+        aes_sw_decrypt(src, dst, blocks, keep_iv);
+        return;
+    }
+    aes_sync();
     dc_flushrange(src, blocks * 16);
     dc_invalidaterange(dst, blocks * 16);
     ahb_flush_to(RB_AES);
@@ -57,8 +231,8 @@ void aes_decrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
     int this_blocks = 0;
     while(blocks > 0) {
         this_blocks = blocks;
-        if (this_blocks > 0x80)
-            this_blocks = 0x80;
+        if (this_blocks > AES_MAX_BLOCKS)
+            this_blocks = AES_MAX_BLOCKS;
 
         write32(AES_SRC, dma_addr(src));
         write32(AES_DEST, dma_addr(dst));
@@ -77,6 +251,11 @@ void aes_decrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
 
 void aes_encrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
 {
+    if (aes_backend == AES_BACKEND_SW) {
+        aes_sw_encrypt(src, dst, blocks, keep_iv);
+        return;
+    }
+    aes_sync();
     dc_flushrange(src, blocks * 16);
     dc_invalidaterange(dst, blocks * 16);
     ahb_flush_to(RB_AES);
@@ -84,8 +263,8 @@ void aes_encrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
     int this_blocks = 0;
     while(blocks > 0) {
         this_blocks = blocks;
-        if (this_blocks > 0x80)
-            this_blocks = 0x80;
+        if (this_blocks > AES_MAX_BLOCKS)
+            this_blocks = AES_MAX_BLOCKS;
         
         write32(AES_SRC, dma_addr(src));
         write32(AES_DEST, dma_addr(dst));
@@ -19,6 +19,38 @@
 
 #define AES_BLOCK_SIZE  16
 
+#define AES_BACKEND_HW  0
+#define AES_BACKEND_SW  1
+
+#define AES_REQ_PENDING 1
+#define AES_REQ_DONE    0
+#define AES_REQ_ERROR   -1
+
+typedef struct aes_req aes_req;
+typedef void (*aes_callback)(aes_req *req);
+
+/* asynchronous aes request, must stay valid until completed */
+struct aes_req {
+    u8 *src;
+    u8 *dst;
+    u32 blocks;
+    u8 decrypt;
+    u8 keep_iv;         /* chain from the previous request */
+    u8 *iv;             /* if set, loaded before the request starts */
+    aes_callback done;  /* called from the irq handler on completion */
+    void *arg;
+
+    /* private */
+    volatile int status;
+    u32 remaining;
+    aes_req *next;
+};
+
+/* select the latte engine or the software implementation, the key
+ * and iv have to be loaded again after switching */
+void aes_set_backend(int backend);
+int aes_get_backend(void);
+
 void aes_reset(void);
 void aes_set_iv(u8 *iv);
 void aes_empty_iv();
@@ -26,4 +58,14 @@ void aes_set_key(u8 *key);
 void aes_decrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv);
 void aes_encrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv);
 
+/* queue a request on the engine, requests run in submission order
+ * with the key currently loaded */
+void aes_submit(aes_req *req);
+/* wait for a request to complete */
+int aes_wait(aes_req *req);
+/* wait for all queued requests to complete */
+void aes_sync(void);
+
+void aes_irq(void);
+
 #endif /* __AES_H__ */
@@ -0,0 +1,238 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "aes_sw.h"
+#include <string.h>
+
+#define AES_SW_ROUNDS   10
+
+/* a single round table per direction, the other three are rotations of
+ * it which the arm barrel shifter applies for free */
+static u32 te0[256], td0[256];
+static u8 sbox[256], inv_sbox[256];
+static bool aes_sw_tables_ready = false;
+
+static u32 enc_key[4 * (AES_SW_ROUNDS + 1)];
+static u32 dec_key[4 * (AES_SW_ROUNDS + 1)];
+static u8 loaded_iv[16], chain_iv[16];
+
+#define ror32(v, n) (((v) >> (n)) | ((v) << (32 - (n))))
+#define rotl8(v, n) ((u8)(((v) << (n)) | ((v) >> (8 - (n)))))
+
+#define get_u32(p) (((u32)(p)[0] << 24) | ((u32)(p)[1] << 16) | ((u32)(p)[2] << 8) | (u32)(p)[3])
+#define put_u32(p, v) do { (p)[0] = (v) >> 24; (p)[1] = (v) >> 16; (p)[2] = (v) >> 8; (p)[3] = (v); } while (0)
+
+static u8 gf_mul(u8 a, u8 b)
+{
+    u8 r = 0;
+    while (b) {
+        if (b & 1)
+            r ^= a;
+        a = (a << 1) ^ ((a & 0x80) ? 0x1b : 0);
+        b >>= 1;
+    }
+    return r;
+}
+
+static void aes_sw_make_tables(void)
+{
+    u8 p = 1, q = 1;
+    int i;
+
+    /* walk the multiplicative group with generator 3 and its inverse */
+    do {
+        p = p ^ (p << 1) ^ ((p & 0x80) ? 0x1b : 0);
+        q ^= q << 1;
+        q ^= q << 2;
+        q ^= q << 4;
+        if (q & 0x80)
+            q ^= 0x09;
+        sbox[p] = 0x63 ^ q ^ rotl8(q, 1) ^ rotl8(q, 2) ^ rotl8(q, 3) ^ rotl8(q, 4);
+    } while (p != 1);
+    sbox[0] = 0x63;
+
+    for (i = 0; i < 256; i++)
+        inv_sbox[sbox[i]] = i;
+
+    for (i = 0; i < 256; i++) {
+        u8 s = sbox[i], is = inv_sbox[i];
+        te0[i] = ((u32)gf_mul(s, 2) << 24) | ((u32)s << 16) | ((u32)s << 8) | gf_mul(s, 3);
+        td0[i] = ((u32)gf_mul(is, 14) << 24) | ((u32)gf_mul(is, 9) << 16) |
+                 ((u32)gf_mul(is, 13) << 8) | gf_mul(is, 11);
+    }
+
+    aes_sw_tables_ready = true;
+}
+
+static inline u32 sub_word(u32 w)
+{
+    return ((u32)sbox[w >> 24] << 24) | ((u32)sbox[(w >> 16) & 0xff] << 16) |
+           ((u32)sbox[(w >> 8) & 0xff] << 8) | sbox[w & 0xff];
+}
+
+static inline u32 inv_mix_word(u32 w)
+{
+    /* td0 undoes the sbox, so feed it sbox outputs */
+    return td0[sbox[w >> 24]] ^ ror32(td0[sbox[(w >> 16) & 0xff]], 8) ^
+           ror32(td0[sbox[(w >> 8) & 0xff]], 16) ^ ror32(td0[sbox[w & 0xff]], 24);
+}
+
+void aes_sw_set_key(const u8 *key)
+{
+    u8 rcon = 1;
+    int i, r;
+
+    if (!aes_sw_tables_ready)
+        aes_sw_make_tables();
+
+    for (i = 0; i < 4; i++)
+        enc_key[i] = get_u32(key + i * 4);
+
+    for (i = 4; i < 4 * (AES_SW_ROUNDS + 1); i++) {
+        u32 t = enc_key[i - 1];
+        if ((i & 3) == 0) {
+            t = sub_word((t << 8) | (t >> 24)) ^ ((u32)rcon << 24);
+            rcon = gf_mul(rcon, 2);
+        }
+        enc_key[i] = enc_key[i - 4] ^ t;
+    }
+
+    /* equivalent inverse cipher: reversed round keys, inner ones mixed */
+    for (r = 0; r <= AES_SW_ROUNDS; r++) {
+        for (i = 0; i < 4; i++) {
+            u32 w = enc_key[(AES_SW_ROUNDS - r) * 4 + i];
+            if (r > 0 && r < AES_SW_ROUNDS)
+                w = inv_mix_word(w);
+            dec_key[r * 4 + i] = w;
+        }
+    }
+}
+
+void aes_sw_set_iv(const u8 *iv)
+{
+    memcpy(loaded_iv, iv, sizeof(loaded_iv));
+}
+
+void aes_sw_empty_iv(void)
+{
+    memset(loaded_iv, 0, sizeof(loaded_iv));
+}
+
+static void aes_sw_encrypt_block(const u8 *in, u8 *out)
+{
+    const u32 *rk = enc_key;
+    u32 s0, s1, s2, s3, t0, t1, t2, t3;
+    int r;
+
+    s0 = get_u32(in) ^ rk[0];
+    s1 = get_u32(in + 4) ^ rk[1];
+    s2 = get_u32(in + 8) ^ rk[2];
+    s3 = get_u32(in + 12) ^ rk[3];
+
+    for (r = 1; r < AES_SW_ROUNDS; r++) {
+        rk += 4;
+        t0 = te0[s0 >> 24] ^ ror32(te0[(s1 >> 16) & 0xff], 8) ^
+             ror32(te0[(s2 >> 8) & 0xff], 16) ^ ror32(te0[s3 & 0xff], 24) ^ rk[0];
+        t1 = te0[s1 >> 24] ^ ror32(te0[(s2 >> 16) & 0xff], 8) ^
+             ror32(te0[(s3 >> 8) & 0xff], 16) ^ ror32(te0[s0 & 0xff], 24) ^ rk[1];
+        t2 = te0[s2 >> 24] ^ ror32(te0[(s3 >> 16) & 0xff], 8) ^
+             ror32(te0[(s0 >> 8) & 0xff], 16) ^ ror32(te0[s1 & 0xff], 24) ^ rk[2];
+        t3 = te0[s3 >> 24] ^ ror32(te0[(s0 >> 16) & 0xff], 8) ^
+             ror32(te0[(s1 >> 8) & 0xff], 16) ^ ror32(te0[s2 & 0xff], 24) ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+
+    /* last round has no mixcolumns */
+    rk += 4;
+    t0 = ((u32)sbox[s0 >> 24] << 24) ^ ((u32)sbox[(s1 >> 16) & 0xff] << 16) ^
+         ((u32)sbox[(s2 >> 8) & 0xff] << 8) ^ sbox[s3 & 0xff] ^ rk[0];
+    t1 = ((u32)sbox[s1 >> 24] << 24) ^ ((u32)sbox[(s2 >> 16) & 0xff] << 16) ^
+         ((u32)sbox[(s3 >> 8) & 0xff] << 8) ^ sbox[s0 & 0xff] ^ rk[1];
+    t2 = ((u32)sbox[s2 >> 24] << 24) ^ ((u32)sbox[(s3 >> 16) & 0xff] << 16) ^
+         ((u32)sbox[(s0 >> 8) & 0xff] << 8) ^ sbox[s1 & 0xff] ^ rk[2];
+    t3 = ((u32)sbox[s3 >> 24] << 24) ^ ((u32)sbox[(s0 >> 16) & 0xff] << 16) ^
+         ((u32)sbox[(s1 >> 8) & 0xff] << 8) ^ sbox[s2 & 0xff] ^ rk[3];
+
+    put_u32(out, t0);
+    put_u32(out + 4, t1);
+    put_u32(out + 8, t2);
+    put_u32(out + 12, t3);
+}
+
+static void aes_sw_decrypt_block(const u8 *in, u8 *out)
+{
+    const u32 *rk = dec_key;
+    u32 s0, s1, s2, s3, t0, t1, t2, t3;
+    int r;
+
+    s0 = get_u32(in) ^ rk[0];
+    s1 = get_u32(in + 4) ^ rk[1];
+    s2 = get_u32(in + 8) ^ rk[2];
+    s3 = get_u32(in + 12) ^ rk[3];
+
+    for (r = 1; r < AES_SW_ROUNDS; r++) {
+        rk += 4;
+        t0 = td0[s0 >> 24] ^ ror32(td0[(s3 >> 16) & 0xff], 8) ^
+             ror32(td0[(s2 >> 8) & 0xff], 16) ^ ror32(td0[s1 & 0xff], 24) ^ rk[0];
+        t1 = td0[s1 >> 24] ^ ror32(td0[(s0 >> 16) & 0xff], 8) ^
+             ror32(td0[(s3 >> 8) & 0xff], 16) ^ ror32(td0[s2 & 0xff], 24) ^ rk[1];
+        t2 = td0[s2 >> 24] ^ ror32(td0[(s1 >> 16) & 0xff], 8) ^
+             ror32(td0[(s0 >> 8) & 0xff], 16) ^ ror32(td0[s3 & 0xff], 24) ^ rk[2];
+        t3 = td0[s3 >> 24] ^ ror32(td0[(s2 >> 16) & 0xff], 8) ^
+             ror32(td0[(s1 >> 8) & 0xff], 16) ^ ror32(td0[s0 & 0xff], 24) ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+
+    rk += 4;
+    t0 = ((u32)inv_sbox[s0 >> 24] << 24) ^ ((u32)inv_sbox[(s3 >> 16) & 0xff] << 16) ^
+         ((u32)inv_sbox[(s2 >> 8) & 0xff] << 8) ^ inv_sbox[s1 & 0xff] ^ rk[0];
+    t1 = ((u32)inv_sbox[s1 >> 24] << 24) ^ ((u32)inv_sbox[(s0 >> 16) & 0xff] << 16) ^
+         ((u32)inv_sbox[(s3 >> 8) & 0xff] << 8) ^ inv_sbox[s2 & 0xff] ^ rk[1];
+    t2 = ((u32)inv_sbox[s2 >> 24] << 24) ^ ((u32)inv_sbox[(s1 >> 16) & 0xff] << 16) ^
+         ((u32)inv_sbox[(s0 >> 8) & 0xff] << 8) ^ inv_sbox[s3 & 0xff] ^ rk[2];
+    t3 = ((u32)inv_sbox[s3 >> 24] << 24) ^ ((u32)inv_sbox[(s2 >> 16) & 0xff] << 16) ^
+         ((u32)inv_sbox[(s1 >> 8) & 0xff] << 8) ^ inv_sbox[s0 & 0xff] ^ rk[3];
+
+    put_u32(out, t0);
+    put_u32(out + 4, t1);
+    put_u32(out + 8, t2);
+    put_u32(out + 12, t3);
+}
+
+void aes_sw_encrypt(const u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
+{
+    u8 block[16];
+    int i;
+
+    if (!keep_iv)
+        memcpy(chain_iv, loaded_iv, sizeof(chain_iv));
+
+    for (; blocks > 0; blocks--, src += 16, dst += 16) {
+        for (i = 0; i < 16; i++)
+            block[i] = src[i] ^ chain_iv[i];
+        aes_sw_encrypt_block(block, chain_iv);
+        memcpy(dst, chain_iv, 16);
+    }
+}
+
+void aes_sw_decrypt(const u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
+{
+    u8 block[16], next_iv[16];
+    int i;
+
+    if (!keep_iv)
+        memcpy(chain_iv, loaded_iv, sizeof(chain_iv));
+
+    /* src and dst may be the same buffer */
+    for (; blocks > 0; blocks--, src += 16, dst += 16) {
+        memcpy(next_iv, src, 16);
+        aes_sw_decrypt_block(src, block);
+        for (i = 0; i < 16; i++)
+            dst[i] = block[i] ^ chain_iv[i];
+        memcpy(chain_iv, next_iv, 16);
+    }
+}
@@ -0,0 +1,22 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef __AES_SW_H__
+#define __AES_SW_H__
+
+#include "common/types.h"
+
+/* software aes-128-cbc, mirrors the state of the hardware engine:
+ * the loaded iv is used whenever keep_iv is 0, otherwise the chain
+ * continues from the last processed block */
+void aes_sw_set_key(const u8 *key);
+void aes_sw_set_iv(const u8 *iv);
+void aes_sw_empty_iv(void);
+void aes_sw_encrypt(const u8 *src, u8 *dst, u32 blocks, u8 keep_iv);
+void aes_sw_decrypt(const u8 *src, u8 *dst, u32 blocks, u8 keep_iv);
+
+#endif /* __AES_SW_H__ */
@@ -14,6 +14,7 @@
 
 u32 crc32_compute(u8 *buf, u32 len);
 
-void crc32_make_table(void);
+/* continue a crc over more data, start from 0 */
+u32 crc32_update(u32 crc, const u8 *buf, u32 len);
 
 #endif
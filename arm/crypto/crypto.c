@@ -14,7 +14,6 @@
 #include "crypto/crypto.h"
 #include "crypto/seeprom.h"
 #include "crypto/aes.h"
-#include "crypto/crc32.h"
 #include "system/latte.h"
 #include "common/utils.h"
 #include "system/memory.h"
@@ -49,7 +48,6 @@ void crypto_initialize(void)
 {
     crypto_read_otp();
     crypto_read_seeprom();
-    crc32_make_table();
 }
 
 int crypto_check_de_Fused()
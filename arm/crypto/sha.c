@@ -16,25 +16,93 @@ A million repetitions of "a"
 
 #include <string.h>
 #include <stdlib.h>
-#include <malloc.h>
 
 #include "crypto/sha.h"
 #include "system/irq.h"
 #include "system/memory.h"
 #include "system/latte.h"
 
-//should be divisible by four
-#define BLOCKSIZE 32
+// unaligned input is bounced through a static buffer this many blocks at a time
+#define SHA_BOUNCE_BLOCKS 32
+
+// runs of up to this many blocks are hashed in software, the engine's
+// dma round-trip costs more than it saves for them
+#define SHA_SW_MAX_BLOCKS 4
 
 #define SHA_CMD_FLAG_EXEC (1<<31)
 #define SHA_CMD_FLAG_IRQ  (1<<30)
 #define SHA_CMD_FLAG_ERR  (1<<29)
 #define SHA_CMD_AREA_BLOCK ((1<<10) - 1)
 
-static void sha_transform(u32 state[SHA_HASH_WORDS], u8 buffer[SHA_BLOCK_SIZE], u32 blocks)
+// the engine takes up to 1024 blocks per command
+#define SHA_HW_MAX_BLOCKS (SHA_CMD_AREA_BLOCK + 1)
+
+static u8 sha_bounce_buf[SHA_BOUNCE_BLOCKS * SHA_BLOCK_SIZE] ALIGNED(64);
+
+#define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+/* blk0() and blk() perform the initial expand. */
+#define blk0(i) (w[i] = ((u32)buffer[(i)*4] << 24) | ((u32)buffer[(i)*4+1] << 16) | \
+                        ((u32)buffer[(i)*4+2] << 8) | (u32)buffer[(i)*4+3])
+#define blk(i) (w[i&15] = rol(w[(i+13)&15]^w[(i+8)&15]^w[(i+2)&15]^w[i&15],1))
+
+/* (R0+R1), R2, R3, R4 are the different operations used in SHA1 */
+#define R0(v,w_,x,y,z,i) z+=((w_&(x^y))^y)+blk0(i)+0x5A827999+rol(v,5);w_=rol(w_,30);
+#define R1(v,w_,x,y,z,i) z+=((w_&(x^y))^y)+blk(i)+0x5A827999+rol(v,5);w_=rol(w_,30);
+#define R2(v,w_,x,y,z,i) z+=(w_^x^y)+blk(i)+0x6ED9EBA1+rol(v,5);w_=rol(w_,30);
+#define R3(v,w_,x,y,z,i) z+=(((w_|x)&y)|(w_&x))+blk(i)+0x8F1BBCDC+rol(v,5);w_=rol(w_,30);
+#define R4(v,w_,x,y,z,i) z+=(w_^x^y)+blk(i)+0xCA62C1D6+rol(v,5);w_=rol(w_,30);
+
+static void sha_transform_sw(u32 state[SHA_HASH_WORDS], const u8 *buffer, u32 blocks)
 {
-    if(blocks == 0) return;
+    u32 a, b, c, d, e;
+    u32 w[16];
+
+    for (; blocks > 0; blocks--, buffer += SHA_BLOCK_SIZE) {
+        /* Copy state[] to working vars */
+        a = state[0];
+        b = state[1];
+        c = state[2];
+        d = state[3];
+        e = state[4];
+
+        /* 4 rounds of 20 operations each. Loop unrolled. */
+        R0(a,b,c,d,e, 0); R0(e,a,b,c,d, 1); R0(d,e,a,b,c, 2); R0(c,d,e,a,b, 3);
+        R0(b,c,d,e,a, 4); R0(a,b,c,d,e, 5); R0(e,a,b,c,d, 6); R0(d,e,a,b,c, 7);
+        R0(c,d,e,a,b, 8); R0(b,c,d,e,a, 9); R0(a,b,c,d,e,10); R0(e,a,b,c,d,11);
+        R0(d,e,a,b,c,12); R0(c,d,e,a,b,13); R0(b,c,d,e,a,14); R0(a,b,c,d,e,15);
+        R1(e,a,b,c,d,16); R1(d,e,a,b,c,17); R1(c,d,e,a,b,18); R1(b,c,d,e,a,19);
+        R2(a,b,c,d,e,20); R2(e,a,b,c,d,21); R2(d,e,a,b,c,22); R2(c,d,e,a,b,23);
+        R2(b,c,d,e,a,24); R2(a,b,c,d,e,25); R2(e,a,b,c,d,26); R2(d,e,a,b,c,27);
+        R2(c,d,e,a,b,28); R2(b,c,d,e,a,29); R2(a,b,c,d,e,30); R2(e,a,b,c,d,31);
+        R2(d,e,a,b,c,32); R2(c,d,e,a,b,33); R2(b,c,d,e,a,34); R2(a,b,c,d,e,35);
+        R2(e,a,b,c,d,36); R2(d,e,a,b,c,37); R2(c,d,e,a,b,38); R2(b,c,d,e,a,39);
+        R3(a,b,c,d,e,40); R3(e,a,b,c,d,41); R3(d,e,a,b,c,42); R3(c,d,e,a,b,43);
+        R3(b,c,d,e,a,44); R3(a,b,c,d,e,45); R3(e,a,b,c,d,46); R3(d,e,a,b,c,47);
+        R3(c,d,e,a,b,48); R3(b,c,d,e,a,49); R3(a,b,c,d,e,50); R3(e,a,b,c,d,51);
+        R3(d,e,a,b,c,52); R3(c,d,e,a,b,53); R3(b,c,d,e,a,54); R3(a,b,c,d,e,55);
+        R3(e,a,b,c,d,56); R3(d,e,a,b,c,57); R3(c,d,e,a,b,58); R3(b,c,d,e,a,59);
+        R4(a,b,c,d,e,60); R4(e,a,b,c,d,61); R4(d,e,a,b,c,62); R4(c,d,e,a,b,63);
+        R4(b,c,d,e,a,64); R4(a,b,c,d,e,65); R4(e,a,b,c,d,66); R4(d,e,a,b,c,67);
+        R4(c,d,e,a,b,68); R4(b,c,d,e,a,69); R4(a,b,c,d,e,70); R4(e,a,b,c,d,71);
+        R4(d,e,a,b,c,72); R4(c,d,e,a,b,73); R4(b,c,d,e,a,74); R4(a,b,c,d,e,75);
+        R4(e,a,b,c,d,76); R4(d,e,a,b,c,77); R4(c,d,e,a,b,78); R4(b,c,d,e,a,79);
+
+        /* Add the working vars back into state[] */
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+
+    /* Wipe variables */
+    a = b = c = d = e = 0;
+    memset(w, 0, sizeof(w));
+}
 
+static void sha_transform_hw(u32 state[SHA_HASH_WORDS], const u8 *buffer, u32 blocks)
+{
     /* Copy ctx->state[] to working vars */
     write32(SHA_H0, state[0]);
     write32(SHA_H1, state[1]);
@@ -42,26 +110,35 @@ static void sha_transform(u32 state[SHA_HASH_WORDS], u8 buffer[SHA_BLOCK_SIZE],
     write32(SHA_H3, state[3]);
     write32(SHA_H4, state[4]);
 
-    // assign block to local copy which is 64-byte aligned
-    u8 *block = memalign(64, SHA_BLOCK_SIZE * blocks);
-    memcpy(block, buffer, SHA_BLOCK_SIZE * blocks);
+    // 64-byte aligned data can be fed to the engine as is
+    bool aligned = !((u32)buffer & 63);
 
-    // royal flush :)
-    dc_flushrange(block, SHA_BLOCK_SIZE * blocks);
-    ahb_flush_to(RB_SHA);
+    while (blocks > 0) {
+        const u8 *block = buffer;
+        u32 this_blocks = min(blocks, aligned ? SHA_HW_MAX_BLOCKS : SHA_BOUNCE_BLOCKS);
 
-    // tell sha1 controller the block source address
-    write32(SHA_SRC, dma_addr(block));
+        if (!aligned) {
+            memcpy(sha_bounce_buf, buffer, SHA_BLOCK_SIZE * this_blocks);
+            block = sha_bounce_buf;
+        }
 
-    // tell sha1 controller number of blocks
-    write32(SHA_CTRL, (read32(SHA_CTRL) & ~(SHA_CMD_AREA_BLOCK)) | (blocks - 1));
+        // royal flush :)
+        dc_flushrange(block, SHA_BLOCK_SIZE * this_blocks);
+        ahb_flush_to(RB_SHA);
 
-    // fire up hashing and wait till its finished
-    write32(SHA_CTRL, read32(SHA_CTRL) | SHA_CMD_FLAG_EXEC);
-    while (read32(SHA_CTRL) & SHA_CMD_FLAG_EXEC);
+        // tell sha1 controller the block source address
+        write32(SHA_SRC, dma_addr((void *)block));
 
-    // free the aligned data
-    free(block);
+        // tell sha1 controller number of blocks
+        write32(SHA_CTRL, (read32(SHA_CTRL) & ~(SHA_CMD_AREA_BLOCK)) | (this_blocks - 1));
+
+        // fire up hashing and wait till its finished
+        write32(SHA_CTRL, read32(SHA_CTRL) | SHA_CMD_FLAG_EXEC);
+        while (read32(SHA_CTRL) & SHA_CMD_FLAG_EXEC);
+
+        buffer += SHA_BLOCK_SIZE * this_blocks;
+        blocks -= this_blocks;
+    }
 
     /* Add the working vars back into ctx.state[] */
     state[0] = read32(SHA_H0);
@@ -71,6 +148,16 @@ static void sha_transform(u32 state[SHA_HASH_WORDS], u8 buffer[SHA_BLOCK_SIZE],
     state[4] = read32(SHA_H4);
 }
 
+static void sha_transform(u32 state[SHA_HASH_WORDS], const u8 *buffer, u32 blocks)
+{
+    if(blocks == 0) return;
+
+    if(blocks <= SHA_SW_MAX_BLOCKS)
+        sha_transform_sw(state, buffer, blocks);
+    else
+        sha_transform_hw(state, buffer, blocks);
+}
+
 void sha_init(sha_ctx* ctx)
 {
     memset(ctx, 0, sizeof(sha_ctx));
@@ -94,19 +181,9 @@ void sha_update(sha_ctx* ctx, const void* inbuf, size_t size)
     if ((j + size) > 63) {
         memcpy(&ctx->buffer[j], data, (i = 64-j));
         sha_transform(ctx->state, ctx->buffer, 1);
-        // try bigger blocks at once
-        for ( ; i + 63 + ((BLOCKSIZE-1)*64) < size; i += (64 + (BLOCKSIZE-1)*64)) {
-            sha_transform(ctx->state, &data[i], BLOCKSIZE);
-        }
-        for ( ; i + 63 + (((BLOCKSIZE/2)-1)*64) < size; i += (64 + ((BLOCKSIZE/2)-1)*64)) {
-            sha_transform(ctx->state, &data[i], BLOCKSIZE/2);
-        }
-        for ( ; i + 63 + (((BLOCKSIZE/4)-1)*64) < size; i += (64 + ((BLOCKSIZE/4)-1)*64)) {
-            sha_transform(ctx->state, &data[i], BLOCKSIZE/4);
-        }
-        for ( ; i + 63 < size; i += 64) {
-            sha_transform(ctx->state, &data[i], 1);
-        }
+        // hash all remaining whole blocks at once
+        sha_transform(ctx->state, &data[i], (size - i) / 64);
+        i += ((size - i) / 64) * 64;
         j = 0;
     }
     else i = 0;
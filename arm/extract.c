@@ -0,0 +1,332 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "common/types.h"
+#include "common/utils.h"
+#include "storage/sd/fatfs/ff.h"
+#include "storage/nand/nand.h"
+#include "storage/nand/ecc.h"
+#include "storage/nand/image.h"
+#include "storage/nand/isfs/isfs.h"
+#include "storage/nand/isfs/volume.h"
+#include "storage/nand/isfs/hmac.h"
+#include "crypto/aes.h"
+#include "video/console.h"
+#include "extract.h"
+
+/* file data is pulled from nand raw in the background, one chunk ahead of
+ * the chunk being corrected, decrypted, verified and written to sd */
+#define EXTRACT_CHUNK_CLUSTERS  8
+#define EXTRACT_CHUNK_PAGES     (EXTRACT_CHUNK_CLUSTERS * CLUSTER_PAGES)
+#define EXTRACT_MAX_DEPTH       16
+
+typedef struct extract_chunk {
+    u32 index;      // first cluster within the file
+    u32 cluster;    // first cluster on nand
+    u32 count;
+} extract_chunk;
+
+static u8 extract_raw[2][EXTRACT_CHUNK_PAGES * IMAGE_PAGE_SIZE] ALIGNED(64);
+static u8 extract_out[EXTRACT_CHUNK_CLUSTERS * CLUSTER_SIZE] ALIGNED(64);
+static aes_req extract_reqs[EXTRACT_CHUNK_CLUSTERS];
+static u8 extract_hmacs[EXTRACT_CHUNK_CLUSTERS][2][20];
+static u32 extract_corrected = 0;
+
+/* split the cluster runs of a file into chunks */
+static bool extract_next_chunk(const isfs_file *file, u32 *run, u32 *offset, extract_chunk *chunk)
+{
+    if (*run >= file->run_count)
+        return false;
+
+    const isfs_run *r = &file->runs[*run];
+    chunk->index = r->first + *offset;
+    chunk->cluster = r->start + *offset;
+    chunk->count = min(r->count - *offset, EXTRACT_CHUNK_CLUSTERS);
+
+    *offset += chunk->count;
+    if (*offset >= r->count) {
+        (*run)++;
+        *offset = 0;
+    }
+    return true;
+}
+
+static int extract_verify(isfs_ctx *ctx, isfs_fst *fst, const extract_chunk *chunk, u32 c)
+{
+    isfs_hmac_data seed = {0};
+    hmac_ctx calc_hmac;
+    u8 hmac[20];
+
+    if (aes_wait(&extract_reqs[c]) < 0)
+        return -1;
+
+    seed.x1 = fst->x1;
+    seed.uid = fst->uid;
+    memcpy(seed.name, fst->name, sizeof(seed.name));
+    seed.iblk = chunk->index + c;
+    seed.ifst = fst - isfs_get_fst(ctx);
+    seed.x3 = fst->x3;
+
+    hmac_init(&calc_hmac, ctx->hmac, 20);
+    hmac_update(&calc_hmac, &seed, sizeof(seed));
+    hmac_update(&calc_hmac, extract_out + c * CLUSTER_SIZE, CLUSTER_SIZE);
+    hmac_final(&calc_hmac, hmac);
+
+    /* one good copy is enough */
+    if (memcmp(extract_hmacs[c][0], hmac, sizeof(hmac)) &&
+        memcmp(extract_hmacs[c][1], hmac, sizeof(hmac)))
+        return -2;
+
+    return 0;
+}
+
+/* ecc correct and decrypt a raw chunk into extract_out, verifying each
+ * cluster while the aes engine works on the next one */
+static int extract_decode(isfs_ctx *ctx, isfs_fst *fst, const extract_chunk *chunk, const u8 *raw)
+{
+    u8 ecc[ECC_PAGE_SIZE] ALIGNED(4);
+    u32 c, p;
+    int res;
+
+    aes_reset();
+    aes_set_key(ctx->key);
+    aes_empty_iv();
+
+    for (c = 0; c < chunk->count; c++) {
+        u8 *out = extract_out + c * CLUSTER_SIZE;
+
+        for (p = 0; p < CLUSTER_PAGES; p++) {
+            const u8 *page = raw + (c * CLUSTER_PAGES + p) * IMAGE_PAGE_SIZE;
+            const u8 *spare = page + PAGE_SIZE;
+
+            memcpy(out + p * PAGE_SIZE, page, PAGE_SIZE);
+            nand_ecc_calc(out + p * PAGE_SIZE, ecc);
+            res = nand_ecc_correct(out + p * PAGE_SIZE, spare + ECC_SPARE_OFFS, ecc, NULL);
+            if (res < 0) {
+                aes_sync();
+                return -1;
+            }
+            extract_corrected += res;
+
+            /* pages 6 and 7 carry the cluster hmac twice */
+            if (p == 6) {
+                memcpy(extract_hmacs[c][0], &spare[1], 20);
+                memcpy(extract_hmacs[c][1], &spare[21], 12);
+            }
+            if (p == 7)
+                memcpy(&extract_hmacs[c][1][12], &spare[1], 8);
+        }
+
+        /* every cluster starts with an empty iv */
+        aes_req *req = &extract_reqs[c];
+        req->src = req->dst = out;
+        req->blocks = CLUSTER_SIZE / AES_BLOCK_SIZE;
+        req->decrypt = 1;
+        req->keep_iv = 0;
+        req->iv = NULL;
+        req->done = NULL;
+        aes_submit(req);
+
+        if (c && (extract_verify(ctx, fst, chunk, c - 1) < 0)) {
+            aes_sync();
+            return -2;
+        }
+    }
+
+    if (extract_verify(ctx, fst, chunk, chunk->count - 1) < 0)
+        return -2;
+
+    return 0;
+}
+
+static int extract_file(isfs_ctx *ctx, isfs_fst *fst, const char *path)
+{
+    u32 clusters = (fst->size + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+    isfs_file file = { .volume = ctx->volume, .fst = fst };
+    isfs_run *runs = malloc(max(clusters, 1) * sizeof(isfs_run));
+    extract_chunk chunk, next;
+    u32 run = 0, offset = 0, k;
+    bool more;
+    UINT bw = 0;
+    FIL fil;
+    int rc = 0;
+
+    if (!runs)
+        return -1;
+    if (isfs_map(&file, runs, max(clusters, 1)) < 0) {
+        printf(CONSOLE_RED "%s: broken cluster chain\n" CONSOLE_RESET, path);
+        free(runs);
+        return -2;
+    }
+
+    if (f_open(&fil, path, FA_WRITE | FA_CREATE_ALWAYS)) {
+        printf(CONSOLE_RED "Cannot create %s\n" CONSOLE_RESET, path);
+        free(runs);
+        return -3;
+    }
+
+    /* allocate the file upfront so the writes stay contiguous */
+    if (f_lseek(&fil, fst->size) || (f_tell(&fil) != fst->size) || f_lseek(&fil, 0)) {
+        printf(CONSOLE_RED "Not enough space on the sd card for %s\n" CONSOLE_RESET, path);
+        rc = -4;
+        goto out;
+    }
+
+    if (!extract_next_chunk(&file, &run, &offset, &chunk))
+        goto out;
+
+    if (nand_batch_begin(ctx->bank, 0) < 0) {
+        rc = -5;
+        goto out_nand;
+    }
+
+    if (nand_bg_read_start(chunk.cluster * CLUSTER_PAGES, chunk.count * CLUSTER_PAGES, extract_raw[0]) < 0) {
+        rc = -5;
+        goto out_nand;
+    }
+
+    for (k = 0; ; k++) {
+        if (nand_bg_read_wait() < 0) {
+            printf(CONSOLE_RED "%s: failed to read cluster %lu\n" CONSOLE_RESET, path, chunk.cluster);
+            rc = -5;
+            goto out_nand;
+        }
+
+        /* read the next chunk while this one is processed and written */
+        more = extract_next_chunk(&file, &run, &offset, &next);
+        if (more && (nand_bg_read_start(next.cluster * CLUSTER_PAGES, next.count * CLUSTER_PAGES,
+                                        extract_raw[(k + 1) & 1]) < 0)) {
+            rc = -5;
+            goto out_nand;
+        }
+
+        rc = extract_decode(ctx, fst, &chunk, extract_raw[k & 1]);
+        if (rc < 0) {
+            printf(CONSOLE_RED "%s: %s in cluster %lu\n" CONSOLE_RESET, path,
+                   (rc == -1) ? "uncorrectable ecc error" : "hmac mismatch", chunk.cluster);
+            if (more)
+                nand_bg_read_wait();
+            rc = -6;
+            goto out_nand;
+        }
+
+        u32 len = min(chunk.count * CLUSTER_SIZE, fst->size - chunk.index * CLUSTER_SIZE);
+        if (f_write(&fil, extract_out, len, &bw) || (bw != len)) {
+            printf(CONSOLE_RED "Failed to write %s\n" CONSOLE_RESET, path);
+            if (more)
+                nand_bg_read_wait();
+            rc = -7;
+            goto out_nand;
+        }
+
+        if (!more)
+            break;
+        chunk = next;
+    }
+
+out_nand:
+    nand_batch_end();
+out:
+    f_close(&fil);
+    free(runs);
+
+    /* don't leave truncated copies behind */
+    if (rc < 0)
+        f_unlink(path);
+    return rc;
+}
+
+static int extract_mkdir(const char *path)
+{
+    FRESULT res = f_mkdir(path);
+
+    if ((res != FR_OK) && (res != FR_EXIST)) {
+        printf(CONSOLE_RED "Cannot create %s\n" CONSOLE_RESET, path);
+        return -1;
+    }
+    return 0;
+}
+
+int extract_tree(const char *src, const char *dst)
+{
+    u16 next[EXTRACT_MAX_DEPTH];
+    u32 len[EXTRACT_MAX_DEPTH];
+    char out[0x100];
+    isfs_ctx *ctx = NULL;
+    const char *path = isfs_do_volume(src, &ctx);
+    isfs_fst *root, *fst;
+    int depth = 0, failed = 0;
+    u32 files = 0, visited = 0;
+
+    if (!ctx || !path || !(fst = isfs_lookup_path(ctx, path))) {
+        printf(CONSOLE_RED "%s not found\n" CONSOLE_RESET, src);
+        return -1;
+    }
+    if (strlen(dst) >= sizeof(out) - EXTRACT_MAX_DEPTH * (sizeof(fst->name) + 1))
+        return -1;
+
+    extract_corrected = 0;
+
+    if (isfs_fst_is_file(fst))
+        return (extract_file(ctx, fst, dst) < 0) ? 1 : 0;
+    if (!isfs_fst_is_dir(fst) || (extract_mkdir(dst) < 0))
+        return -2;
+
+    /* walk the subtree depth first without recursion */
+    root = isfs_get_fst(ctx);
+    strcpy(out, dst);
+    next[0] = fst->sub;
+    len[0] = strlen(out);
+
+    while (depth >= 0) {
+        u16 i = next[depth];
+
+        if ((i == 0xFFFF) || (i >= ISFS_FST_COUNT) || (++visited > ISFS_FST_COUNT)) {
+            depth--;
+            continue;
+        }
+
+        fst = &root[i];
+        next[depth] = fst->sib;
+
+        out[len[depth]] = '/';
+        memcpy(out + len[depth] + 1, fst->name, sizeof(fst->name));
+        out[len[depth] + 1 + sizeof(fst->name)] = '\0';
+
+        if (isfs_fst_is_dir(fst)) {
+            if (extract_mkdir(out) < 0) {
+                failed++;
+                continue;
+            }
+            if ((depth + 1) < EXTRACT_MAX_DEPTH) {
+                depth++;
+                next[depth] = fst->sub;
+                len[depth] = strlen(out);
+            } else if (fst->sub != 0xFFFF) {
+                /* don't drop a subtree nested deeper than isfs allows silently */
+                printf(CONSOLE_RED "\r\e[K%s: too deeply nested, skipped\n" CONSOLE_RESET, out);
+                failed++;
+            }
+        } else if (isfs_fst_is_file(fst)) {
+            printf("\r\e[K%s", out);
+            if (extract_file(ctx, fst, out) < 0)
+                failed++;
+            else
+                files++;
+        }
+    }
+
+    printf("\r\e[K%lu files extracted to %s", files, dst);
+    if (extract_corrected)
+        printf(", %lu bits needed ecc correction", extract_corrected);
+    printf("\n");
+
+    return failed;
+}
@@ -0,0 +1,18 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef __EXTRACT_H__
+#define __EXTRACT_H__
+
+#include "common/types.h"
+
+/* copy a file or directory tree of a mounted isfs volume (like
+ * "slc:/sys/config") to a path on the sd card, returns the number of
+ * files that couldn't be extracted or a negative error */
+int extract_tree(const char *src, const char *dst);
+
+#endif
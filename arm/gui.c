@@ -7,16 +7,27 @@
 #include "storage/sd/sdcard.h"
 #include "storage/sd/fatfs/elm.h"
 #include "storage/nand/nand.h"
+#include "storage/nand/nand_stats.h"
+#include "storage/nand/isfs/cache.h"
 #include "crypto/crypto.h"
 #include "system/smc.h"
 #include "common/utils.h"
 #include "gui.h"
 #include "installer.h"
+#include "backup.h"
+#include "extract.h"
+#include "storage/nand/isfs/isfs.h"
+#include "storage/nand/isfs/super.h"
+#include "storage/nand/isfs/volume.h"
 #include "video/menu.h"
 #include <stdio.h>
 
 static void main_install(menu_t *menu);
 static void main_uninstall(menu_t *menu);
+static void main_backup(menu_t *menu);
+static void main_restore(menu_t *menu);
+static void main_extract(menu_t *menu);
+static void main_nand_stats(menu_t *menu);
 static void main_credits(menu_t *menu);
 
 static int ask_confirmation(void);
@@ -30,9 +41,13 @@ static menu_t m_main = {
         {},
         {"Power off", &menu_close, 1},
         {},
+        {"Backup NAND to SD", &main_backup, 1},
+        {"Restore NAND from SD", &main_restore, 1},
+        {"Extract SLC config to SD", &main_extract, 1},
+        {"NAND statistics", &main_nand_stats, 1},
         {"Credits", &main_credits, 1},
     },
-    .entries = 6,
+    .entries = 10,
 };
 
 void gui_main() {
@@ -102,6 +117,75 @@ static void main_uninstall(menu_t *menu) {
     wait_continue();
 }
 
+static void main_backup(menu_t *menu) {
+    puts("\e[2;0H\e[0JBacking up NAND to slc.raw and slccmpt.raw...");
+    backup_nand();
+
+    wait_continue();
+}
+
+static void main_restore(menu_t *menu) {
+    static restore_plan plans[2] = {
+        { .bank = BANK_SLC, .path = "slc.raw" },
+        { .bank = BANK_SLCCMPT, .path = "slccmpt.raw" },
+    };
+    int i;
+
+    puts("\e[2;0H\e[0JComparing NAND with slc.raw and slccmpt.raw...");
+    for (i = 0; i < 2; i++)
+        if (restore_scan(&plans[i]) < 0) {
+            wait_continue();
+            return;
+        }
+
+    if (!plans[0].count && !plans[1].count) {
+        puts("\nNAND already matches the backup");
+        wait_continue();
+        return;
+    }
+
+    printf("\n%lu SLC and %lu SLCCMPT blocks differ from the backup.\n\n"
+        "Erase and reprogram them now?\n", plans[0].count, plans[1].count);
+    if (!ask_confirmation()) return;
+
+    puts("\e[2;0H\e[0JRestoring NAND...");
+    for (i = 0; i < 2; i++)
+        if (restore_apply(&plans[i]) < 0)
+            printf("Some %s blocks could not be restored\n", plans[i].path);
+
+    /* remount on top of the restored contents */
+    isfs_fini();
+    isfs_invalidate_super(isfs_get_volume(ISFSVOL_SLC));
+    isfs_invalidate_super(isfs_get_volume(ISFSVOL_SLCCMPT));
+    isfs_init();
+
+    wait_continue();
+}
+
+static void main_extract(menu_t *menu) {
+    puts("\e[2;0H\e[0JExtracting slc:/sys/config to slc_config...");
+
+    if (extract_tree("slc:/sys/config", "slc_config") != 0)
+        puts("Some files could not be extracted");
+
+    wait_continue();
+}
+
+static void main_nand_stats(menu_t *menu) {
+    const isfs_cache_stats *cache = isfs_cache_get_stats();
+
+    puts("\e[2;0H\e[0JNAND statistics\n");
+    nand_stats_print();
+    printf("\nisfs cluster cache: %lu hits, %lu misses\n", cache->hits, cache->misses);
+
+    if (nand_stats_save("nand_stats.txt") < 0)
+        puts("\nFailed to save nand_stats.txt");
+    else
+        puts("\nSaved to nand_stats.txt");
+
+    wait_continue();
+}
+
 static void main_credits(menu_t *menu) {
     puts(
         "\e[2;0H\e[0JThanks to:\n\n"
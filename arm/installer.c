@@ -19,12 +19,16 @@
 #include "storage/nand/isfs/super.h"
 #include "storage/nand/isfs/volume.h"
 #include "storage/nand/isfs/isfshax.h"
+#include "storage/nand/isfs/health.h"
 #include "crypto/crypto.h"
 #include "crypto/sha.h"
 #include "video/console.h"
 #include "installer.h"
 #include "boot1.h"
 
+static int _check_compatibility(void);
+static int _install_isfshax(void);
+static int _uninstall_isfshax(void);
 static int _load_isfshax_superblock(isfshax_super *s_isfshax);
 static int _load_file_to_mem(const char *path, void *buf, u32 size);
 
@@ -38,7 +42,34 @@ void pr_error(const char *fmt, ...) {
     va_end(va);
 }
 
+/* the installer switches the slc context between the isfshax and the normal
+ * superblock, take slc:/ and slccmpt:/ down meanwhile and remount them on
+ * the normal superblock afterwards */
 int installer_check_compatibility(void)
+{
+    isfs_fini();
+    int status = _check_compatibility();
+    isfs_init();
+    return status;
+}
+
+int install_isfshax(void)
+{
+    isfs_fini();
+    int rc = _install_isfshax();
+    isfs_init();
+    return rc;
+}
+
+int uninstall_isfshax(void)
+{
+    isfs_fini();
+    int rc = _uninstall_isfshax();
+    isfs_init();
+    return rc;
+}
+
+static int _check_compatibility(void)
 {
     isfs_ctx *slc = isfs_get_volume(ISFSVOL_SLC);
     int status = ISFSHAX_INSTALL_POSSIBLE | ISFSHAX_REMOVAL_POSSIBLE;
@@ -66,6 +97,24 @@ int installer_check_compatibility(void)
         printf(CONSOLE_RED "Unsupported (%d)\n" CONSOLE_RESET, boot1ver);
     }
 
+    /* report bad blocks in the slc superblock region, the only part
+     * the installer writes to */
+    fputs("\nSLC bad blocks:      ", stdout);
+    u32 super_blocks = slc->super_count * ISFSSUPER_BLOCKS;
+    int read_errors = 0, bad_blocks = -1;
+    if (nand_batch_begin(BANK_SLC, 0) >= 0)
+        bad_blocks = nand_scan_bad_blocks(BLOCK_COUNT - super_blocks, super_blocks, NULL, &read_errors);
+    nand_batch_end();
+    if (bad_blocks < 0) {
+        status &= ~ISFSHAX_INSTALL_POSSIBLE;
+        puts(CONSOLE_RED "Scan failed" CONSOLE_RESET);
+    } else if (!bad_blocks && !read_errors)
+        puts(CONSOLE_GREEN "None" CONSOLE_RESET);
+    else if (!read_errors)
+        printf("%d\n", bad_blocks);
+    else
+        printf("%d, " CONSOLE_RED "%d unreadable\n" CONSOLE_RESET, bad_blocks, read_errors);
+
     /* check if isfshax is already installed to allow removal */
     fputs("\nisfshax:             ", stdout);
     if ((isfs_load_super(slc, ISFSHAX_GENERATION_FIRST, 0xffffffff) >= 0) &&
@@ -82,13 +131,13 @@ int installer_check_compatibility(void)
     return status;
 }
 
-int install_isfshax(void)
+static int _install_isfshax(void)
 {
     static isfshax_super s_isfshax = {0};
     isfs_ctx *slc = isfs_get_volume(ISFSVOL_SLC);
     int good_slots, needed_slots = ISFSHAX_REDUNDANCY, isfshax_okay = 0;
     isfshax_info isfshax = { };
-    int i, index, rc;
+    int i, index, pass, rc;
 
     puts("Loading and verifying crafted isfshax superblock");
 
@@ -123,17 +172,49 @@ int install_isfshax(void)
         return -2;
     }
 
-    /* allocate the slots needed for isfshax */
-    good_slots = 0;
-    for (index = (slc->super_count - 1); index >= 0; index--) {
-        if (isfs_super_check_slot(slc, index) < 0) continue;
+    /* know which slots are worth using before writing anything */
+    fputs("Loading slot health table... ", stdout);
+    if (isfs_health_load(slc) >= 0) {
+        puts("OK");
+    } else {
+        puts("Not found or not from this console, scanning");
+        if (isfs_health_scan(slc) >= 0)
+            isfs_health_save(slc);
+    }
 
-        if (needed_slots > 0) {
-            isfs_super_mark_bad_slot(slc, index);
-            isfshax.slots[--needed_slots].slot = index;
-            printf("Allocated slot %d for isfshax\n", index);
+    /* allocate the slots needed for isfshax, preferring slots that
+     * never needed ecc correction */
+    good_slots = 0;
+    for (pass = 0; pass < 2; pass++) {
+        for (index = (slc->super_count - 1); index >= 0; index--) {
+            if (isfs_super_check_slot(slc, index) < 0) continue;
+
+            /* the spare scan found a factory bad block in this slot, this
+             * comes from the nand itself so it overrides the health table */
+            if (slc->slots[index].status & ISFS_SLOT_BAD_BLOCK) {
+                if (pass == 0)
+                    printf("Skipping slot %d, it contains a bad block\n", index);
+                continue;
+            }
+
+            int health = isfs_health_slot(slc, index);
+            if (health == ISFS_HEALTH_BAD) {
+                if (pass == 0)
+                    printf("Skipping slot %d, it is unhealthy\n", index);
+                continue;
+            }
+            if ((pass == 0) && (health != ISFS_HEALTH_GOOD)) continue;
+
+            /* an unreadable bad block marker is only used as a last resort */
+            if ((pass == 0) && (slc->slots[index].status & ISFS_SLOT_SPARE_ERROR)) continue;
+
+            if (needed_slots > 0) {
+                isfs_super_mark_bad_slot(slc, index);
+                isfshax.slots[--needed_slots].slot = index;
+                printf("Allocated slot %d for isfshax\n", index);
+            }
+            else if (pass == 1) good_slots++;
         }
-        else good_slots++;
     }
     if (good_slots < 16) {
         pr_error("The nand contains too many bad superblock slots, cannot safely proceed\n");
@@ -168,6 +249,7 @@ int install_isfshax(void)
         }
         isfshax.generation++;
     }
+    isfs_health_save(slc);
     if (!isfshax_okay) {
         pr_error("Couldn't write to any isfshax slot!\n");
         return -5;
@@ -177,7 +259,7 @@ int install_isfshax(void)
     return 0;
 }
 
-int uninstall_isfshax(void)
+static int _uninstall_isfshax(void)
 {
     isfshax_info isfshax;
     isfs_ctx *slc = isfs_get_volume(ISFSVOL_SLC);
@@ -214,8 +296,7 @@ int uninstall_isfshax(void)
 
         /* (attempt to) erase isfshax superblocks */
         printf("Erasing isfshax slot %d (isfs slot %lu, block %lu-%lu)\n", i, slot, block+0, block+1);
-        nand_erase_block(block+0);
-        nand_erase_block(block+1);
+        isfs_erase_super(slc, slot);
 
         if (isfshax.slots[i].bad)
             continue;
@@ -29,7 +29,10 @@
 #include "storage/sd/sdcard.h"
 #include "storage/sd/fatfs/elm.h"
 #include "storage/nand/nand.h"
+#include "storage/nand/image.h"
+#include "storage/nand/isfs/isfs.h"
 #include "crypto/crypto.h"
+#include "crypto/aes.h"
 #include "system/smc.h"
 #include "common/utils.h"
 #include "gui.h"
@@ -72,13 +75,35 @@ void NORETURN _main(void* base) {
         }
     }
     
+#if NAND_IMAGE_ENABLED
+    printf("Redirecting NAND accesses to sdmc:/slc.raw and sdmc:/slccmpt.raw\n");
+    if (nand_image_attach(BANK_SLC, "slc.raw") ||
+        nand_image_attach(BANK_SLCCMPT, "slccmpt.raw")) {
+        printf("Failed to attach NAND images!\n");
+        panic(0);
+    }
+
+    /* keep the simulated nand off the hardware, crypto included */
+    aes_set_backend(AES_BACKEND_SW);
+#endif
+
     nand_initialize();
 
+    /* mount slc:/ and slccmpt:/ */
+    isfs_init();
+
     smc_get_events();
     smc_set_odd_power(false);
 
     gui_main();
 
+    isfs_fini();
+
+#if NAND_IMAGE_ENABLED
+    nand_image_detach(BANK_SLCCMPT);
+    nand_image_detach(BANK_SLC);
+#endif
+
     ELM_Unmount();
     sdcard_exit();
     irq_disable(IRQ_SD0);
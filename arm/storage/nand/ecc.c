@@ -0,0 +1,105 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "ecc.h"
+
+/* parity of every byte value */
+static const u8 ecc_parity[0x100] = {
+#define P2(n) n, n ^ 1, n ^ 1, n
+#define P4(n) P2(n), P2(n ^ 1), P2(n ^ 1), P2(n)
+#define P6(n) P4(n), P4(n ^ 1), P4(n ^ 1), P4(n)
+    P6(0), P6(1), P6(1), P6(0)
+#undef P6
+#undef P4
+#undef P2
+};
+
+/*
+ * Each subpage code is two 12 bit words, one with the parities of the bits
+ * whose address has a given address bit set (odd) and one with the bits
+ * where it's clear (even). Bits 0-2 select the bit in a byte and only
+ * depend on the xor of all bytes, bits 3-11 are the byte address bits of
+ * the bytes with odd parity xored together. The even word is the odd one
+ * flipped wherever the total parity is set.
+ */
+static void ecc_calc_subpage(const u8 *data, u8 *ecc)
+{
+    u32 x = 0, addr = 0, i;
+    u32 odd, even;
+
+    for (i = 0; i < ECC_SUBPAGE_SIZE; i += 4) {
+        u8 b0 = data[i], b1 = data[i + 1], b2 = data[i + 2], b3 = data[i + 3];
+
+        x ^= b0 ^ b1 ^ b2 ^ b3;
+        addr ^= (i & -(u32)ecc_parity[b0]) ^ ((i + 1) & -(u32)ecc_parity[b1]) ^
+                ((i + 2) & -(u32)ecc_parity[b2]) ^ ((i + 3) & -(u32)ecc_parity[b3]);
+    }
+
+    odd = ecc_parity[x & 0xaa] | (ecc_parity[x & 0xcc] << 1) | (ecc_parity[x & 0xf0] << 2) | (addr << 3);
+    even = ecc_parity[x & 0x55] | (ecc_parity[x & 0x33] << 1) | (ecc_parity[x & 0x0f] << 2) |
+           ((addr ^ (ecc_parity[x] ? 0x1ff : 0)) << 3);
+
+    ecc[0] = even;
+    ecc[1] = even >> 8;
+    ecc[2] = odd;
+    ecc[3] = odd >> 8;
+}
+
+void nand_ecc_calc(const void *data, void *ecc)
+{
+    for (int i = 0; i < ECC_SUBPAGES; i++)
+        ecc_calc_subpage((const u8 *)data + i * ECC_SUBPAGE_SIZE, (u8 *)ecc + i * 4);
+}
+
+static int ecc_correct_subpage(u8 *data, const u8 *save, const u8 *calc)
+{
+    u32 even, odd, syndrome;
+
+    /* don't try to correct unformatted pages */
+    if ((save[0] & save[1] & save[2] & save[3]) == 0xff)
+        return 0;
+
+    even = (save[0] ^ calc[0]) | (((save[1] ^ calc[1]) & 0xf) << 8);
+    odd = (save[2] ^ calc[2]) | (((save[3] ^ calc[3]) & 0xf) << 8);
+    syndrome = even | (odd << 12);
+
+    if (!syndrome)
+        return 0;
+
+    /* a single flipped bit in the ecc itself */
+    if (!(syndrome & (syndrome - 1)))
+        return 1;
+
+    /* a single flipped data bit flips exactly one of each pair */
+    if ((even ^ odd) != 0xfff)
+        return ECC_UNCORRECTABLE;
+
+    data[odd >> 3] ^= 1 << (odd & 7);
+    return 1;
+}
+
+int nand_ecc_correct(u8 *data, const void *ecc_save, const void *ecc_calc, s8 *bits)
+{
+    const u8 *save = ecc_save, *calc = ecc_calc;
+    int total = 0, res;
+
+    for (int i = 0; i < ECC_SUBPAGES; i++) {
+        if (*(const u32 *)(save + i * 4) == *(const u32 *)(calc + i * 4))
+            res = 0;
+        else
+            res = ecc_correct_subpage(data + i * ECC_SUBPAGE_SIZE, save + i * 4, calc + i * 4);
+
+        if (bits)
+            bits[i] = res;
+        if ((res < 0) || (total < 0))
+            total = ECC_UNCORRECTABLE;
+        else
+            total += res;
+    }
+
+    return total;
+}
@@ -0,0 +1,31 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef __NAND_ECC_H__
+#define __NAND_ECC_H__
+
+#include "common/types.h"
+
+/* the controller stores a 4 byte hamming code for every 0x200 bytes */
+#define ECC_SUBPAGE_SIZE    0x200
+#define ECC_SUBPAGES        4
+#define ECC_PAGE_SIZE       (ECC_SUBPAGES * 4)
+#define ECC_SPARE_OFFS      0x30 // stored ecc within the spare
+
+/* per subpage correction results */
+#define ECC_UNCORRECTABLE   (-1)
+
+/* compute the ecc of a page like the nand controller does, this doesn't
+ * touch the hardware and can be built on the host too */
+void nand_ecc_calc(const void *data, void *ecc);
+
+/* compare stored and calculated ecc of a page and fix single bit errors,
+ * bits (if not NULL) receives the flipped bits of every subpage or
+ * ECC_UNCORRECTABLE, returns the total or -1 if any can't be corrected */
+int nand_ecc_correct(u8 *data, const void *ecc_save, const void *ecc_calc, s8 *bits);
+
+#endif
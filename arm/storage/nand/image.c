@@ -0,0 +1,139 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2021          rw-r-r-0644
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "image.h"
+#include "nand.h"
+#include "common/types.h"
+#include "storage/sd/fatfs/ff.h"
+#include <string.h>
+#include <stdio.h>
+
+#if NAND_IMAGE_ENABLED
+
+static FIL nand_images[4];
+static u32 nand_images_attached = 0;
+
+static u8 nand_image_erased[IMAGE_PAGE_SIZE];
+
+int nand_image_attach(u32 bank, const char *path)
+{
+    FIL *fil = &nand_images[bank & 3];
+
+    if (nand_images_attached & (1 << (bank & 3)))
+        nand_image_detach(bank);
+
+    if (f_open(fil, path, FA_READ | FA_WRITE | FA_OPEN_EXISTING)) {
+        printf("nand: cannot open image %s\n", path);
+        return -1;
+    }
+
+    if (f_size(fil) != IMAGE_SIZE) {
+        printf("nand: %s is not a raw nand image (size %lu)\n", path, f_size(fil));
+        f_close(fil);
+        return -2;
+    }
+
+    nand_images_attached |= 1 << (bank & 3);
+    return 0;
+}
+
+void nand_image_detach(u32 bank)
+{
+    if (!(nand_images_attached & (1 << (bank & 3))))
+        return;
+
+    f_close(&nand_images[bank & 3]);
+    nand_images_attached &= ~(1 << (bank & 3));
+}
+
+bool nand_image_attached(void)
+{
+    return nand_images_attached != 0;
+}
+
+/* seek to offs within a page, pages past the end of the nand are rejected
+ * so they can't grow the image */
+static FIL *nand_image_seek(u32 bank, u32 pageno, u32 offs)
+{
+    FIL *fil = &nand_images[bank & 3];
+
+    if (!(nand_images_attached & (1 << (bank & 3)))) {
+        printf("nand: no image attached to bank %lu\n", bank);
+        return NULL;
+    }
+
+    if (pageno >= (BLOCK_COUNT * BLOCK_PAGES))
+        return NULL;
+
+    if (f_lseek(fil, pageno * IMAGE_PAGE_SIZE + offs))
+        return NULL;
+
+    return fil;
+}
+
+int nand_image_read_page(u32 bank, u32 pageno, void *data, void *spare)
+{
+    UINT br = 0;
+    FIL *fil = nand_image_seek(bank, pageno, 0);
+    if (!fil)
+        return -1;
+
+    if (f_read(fil, data, PAGE_SIZE, &br) || (br != PAGE_SIZE))
+        return -2;
+    if (f_read(fil, spare, SPARE_SIZE, &br) || (br != SPARE_SIZE))
+        return -2;
+
+    return 0;
+}
+
+int nand_image_read_spare(u32 bank, u32 pageno, void *spare)
+{
+    UINT br = 0;
+    FIL *fil = nand_image_seek(bank, pageno, PAGE_SIZE);
+    if (!fil)
+        return -1;
+    if (f_read(fil, spare, SPARE_SIZE, &br) || (br != SPARE_SIZE))
+        return -2;
+
+    return 0;
+}
+
+int nand_image_write_page(u32 bank, u32 pageno, const void *data, const void *spare)
+{
+    UINT bw = 0;
+    FIL *fil = nand_image_seek(bank, pageno, 0);
+    if (!fil)
+        return -1;
+
+    if (f_write(fil, data, PAGE_SIZE, &bw) || (bw != PAGE_SIZE))
+        return -3;
+    if (f_write(fil, spare, SPARE_SIZE, &bw) || (bw != SPARE_SIZE))
+        return -3;
+
+    return 0;
+}
+
+int nand_image_erase_block(u32 bank, u32 blockno)
+{
+    UINT bw = 0;
+    FIL *fil = nand_image_seek(bank, blockno * BLOCK_PAGES, 0);
+    if (!fil)
+        return -1;
+
+    if (nand_image_erased[0] != 0xff)
+        memset(nand_image_erased, 0xff, sizeof(nand_image_erased));
+
+    for (int p = 0; p < BLOCK_PAGES; p++)
+        if (f_write(fil, nand_image_erased, IMAGE_PAGE_SIZE, &bw) || (bw != IMAGE_PAGE_SIZE))
+            return -3;
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2021          rw-r-r-0644
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef __NAND_IMAGE_H__
+#define __NAND_IMAGE_H__
+
+#include "common/types.h"
+#include "nand.h"
+
+/* raw nand images store each page followed by its spare */
+#define IMAGE_PAGE_SIZE     (PAGE_SIZE + SPARE_SIZE)
+#define IMAGE_SIZE          (PAGE_COUNT * IMAGE_PAGE_SIZE)
+
+/* back a nand bank with a raw image on the sd card */
+int nand_image_attach(u32 bank, const char *path);
+
+/* flush and release the image backing a nand bank */
+void nand_image_detach(u32 bank);
+
+/* check whether nand accesses are redirected to images */
+bool nand_image_attached(void);
+
+/* read page and raw spare from an image */
+int nand_image_read_page(u32 bank, u32 pageno, void *data, void *spare);
+
+/* read only the raw spare of a page from an image */
+int nand_image_read_spare(u32 bank, u32 pageno, void *spare);
+
+/* write page and spare (including ecc) to an image */
+int nand_image_write_page(u32 bank, u32 pageno, const void *data, const void *spare);
+
+/* erase a block of pages in an image */
+int nand_image_erase_block(u32 bank, u32 blockno);
+
+#endif
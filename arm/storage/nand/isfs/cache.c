@@ -0,0 +1,92 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "common/types.h"
+#include "common/utils.h"
+#include "storage/nand/nand.h"
+#include <string.h>
+
+#include "isfs.h"
+#include "volume.h"
+#include "super.h"
+#include "cache.h"
+
+typedef struct isfs_cache_tag {
+    int volume;         // -1 when the entry is free
+    u32 cluster;
+    u32 generation;     // superblock generation the cluster was read under
+    u32 used;           // lru stamp
+} isfs_cache_tag;
+
+static u8 isfs_cache_data[ISFS_CACHE_ENTRIES][CLUSTER_SIZE] ALIGNED(64);
+static isfs_cache_tag isfs_cache_tags[ISFS_CACHE_ENTRIES] = {
+    [0 ... ISFS_CACHE_ENTRIES - 1] = { .volume = -1 },
+};
+static u32 isfs_cache_clock = 0;
+static isfs_cache_stats isfs_cache_counters;
+
+const u8* isfs_cache_get(isfs_ctx* ctx, u32 cluster)
+{
+    u32 generation = isfs_get_super_generation(ctx->super);
+    isfs_cache_tag* victim = &isfs_cache_tags[0];
+    int i;
+
+    for (i = 0; i < ISFS_CACHE_ENTRIES; i++)
+    {
+        isfs_cache_tag* tag = &isfs_cache_tags[i];
+
+        if (tag->volume == ctx->volume && tag->cluster == cluster &&
+            tag->generation == generation)
+        {
+            isfs_cache_counters.hits++;
+            tag->used = ++isfs_cache_clock;
+            return isfs_cache_data[i];
+        }
+
+        /* free entries first, then the least recently used */
+        if (victim->volume >= 0 && (tag->volume < 0 || tag->used < victim->used))
+            victim = tag;
+    }
+
+    isfs_cache_counters.misses++;
+    i = victim - isfs_cache_tags;
+    victim->volume = -1;
+
+    if (isfs_read_volume(ctx, cluster, 1, ISFSVOL_FLAG_ENCRYPTED, NULL, isfs_cache_data[i]) < 0)
+        return NULL;
+
+    victim->volume = ctx->volume;
+    victim->cluster = cluster;
+    victim->generation = generation;
+    victim->used = ++isfs_cache_clock;
+    return isfs_cache_data[i];
+}
+
+void isfs_cache_invalidate(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count)
+{
+    for (int i = 0; i < ISFS_CACHE_ENTRIES; i++)
+    {
+        isfs_cache_tag* tag = &isfs_cache_tags[i];
+
+        if (tag->volume != ctx->volume)
+            continue;
+        if (cluster_count && (tag->cluster < start_cluster || tag->cluster >= start_cluster + cluster_count))
+            continue;
+
+        tag->volume = -1;
+    }
+}
+
+const isfs_cache_stats* isfs_cache_get_stats(void)
+{
+    return &isfs_cache_counters;
+}
+
+void isfs_cache_reset_stats(void)
+{
+    memset(&isfs_cache_counters, 0, sizeof(isfs_cache_counters));
+}
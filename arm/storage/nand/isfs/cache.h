@@ -0,0 +1,20 @@
+#pragma once
+#include "isfs.h"
+
+/* decrypted clusters kept around for small reads */
+#define ISFS_CACHE_ENTRIES  8
+
+typedef struct isfs_cache_stats {
+    u32 hits;
+    u32 misses;
+} isfs_cache_stats;
+
+/* decrypted contents of a file data cluster, NULL if it can't be read;
+ * the pointer stays valid until the next cache call */
+const u8* isfs_cache_get(isfs_ctx* ctx, u32 cluster);
+
+/* drop cached clusters of a volume, count 0 drops all of them */
+void isfs_cache_invalidate(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count);
+
+const isfs_cache_stats* isfs_cache_get_stats(void);
+void isfs_cache_reset_stats(void);
@@ -0,0 +1,217 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "common/types.h"
+#include "common/utils.h"
+#include "storage/nand/nand.h"
+#include "storage/sd/fatfs/ff.h"
+#include "crypto/crc32.h"
+#include "crypto/sha.h"
+#include <stdio.h>
+#include <string.h>
+
+#include "isfs.h"
+#include "volume.h"
+#include "super.h"
+#include "health.h"
+
+#define ISFS_HEALTH_MAGIC   0x484c5448 // "HLTH"
+
+/* a single failed read can be a transient error, only repeated ones make
+ * a block bad; write errors always do */
+#define ISFS_HEALTH_READ_ERRORS_BAD 2
+
+typedef struct isfs_health_hdr {
+    u32 magic;
+    u32 count;
+    u32 crc;
+    u8 console[SHA_HASH_SIZE];  // sha1 of the volume hmac key
+} PACKED isfs_health_hdr;
+
+static u32 isfs_health_blocks(isfs_ctx* ctx)
+{
+    return ctx->super_count * ISFSSUPER_BLOCKS;
+}
+
+static u32 isfs_health_first_block(isfs_ctx* ctx)
+{
+    return BLOCK_COUNT - isfs_health_blocks(ctx);
+}
+
+static void isfs_health_path(isfs_ctx* ctx, char* path, size_t size)
+{
+    snprintf(path, size, "%s_health.bin", ctx->name);
+}
+
+static inline void isfs_health_inc(u8* counter)
+{
+    if (*counter < 0xff)
+        (*counter)++;
+}
+
+int isfs_health_scan(isfs_ctx* ctx)
+{
+    static u8 pages[CLUSTER_PAGES][PAGE_SIZE] ALIGNED(64);
+    u32 first = isfs_health_first_block(ctx);
+    u32 b, c;
+    int res;
+
+    if (nand_batch_begin(ctx->bank, 0) < 0)
+    {
+        nand_batch_end();
+        ctx->health_valid = false;
+        return -1;
+    }
+    memset(ctx->health, 0, isfs_health_blocks(ctx) * sizeof(isfs_block_health));
+
+    for (b = 0; b < isfs_health_blocks(ctx); b++)
+    {
+        isfs_block_health* health = &ctx->health[b];
+
+        res = nand_block_is_bad(first + b);
+        if (res > 0)
+        {
+            health->bad = 1;
+            continue;
+        }
+        if (res < 0)
+        {
+            isfs_health_inc(&health->read_errors);
+            continue;
+        }
+
+        /* read the whole block, counting the pages needing correction */
+        for (c = 0; c < BLOCK_CLUSTERS; c++)
+        {
+            res = nand_read_pages((first + b) * BLOCK_PAGES + c * CLUSTER_PAGES,
+                                  CLUSTER_PAGES, pages, NULL);
+            if (res < 0)
+                isfs_health_inc(&health->read_errors);
+            else
+                health->ecc_corrected = min(health->ecc_corrected + res, 0xff);
+        }
+    }
+
+    nand_batch_end();
+
+    ctx->health_valid = true;
+    return 0;
+}
+
+/* tie the table to the console it was built on without storing the key */
+static void isfs_health_console(isfs_ctx* ctx, u8* console)
+{
+    sha_hash(ctx->hmac, console, 20);
+}
+
+int isfs_health_load(isfs_ctx* ctx)
+{
+    u8 console[SHA_HASH_SIZE];
+    isfs_health_hdr hdr;
+    u32 size = isfs_health_blocks(ctx) * sizeof(isfs_block_health);
+    char path[0x20];
+    UINT br = 0;
+    FIL fil;
+    int rc = 0;
+
+    isfs_health_path(ctx, path, sizeof(path));
+    if (f_open(&fil, path, FA_READ))
+        return -1;
+
+    isfs_health_console(ctx, console);
+
+    if (f_read(&fil, &hdr, sizeof(hdr), &br) || (br != sizeof(hdr)) ||
+        (hdr.magic != ISFS_HEALTH_MAGIC) || (hdr.count != isfs_health_blocks(ctx)))
+        rc = -2;
+    else if (memcmp(hdr.console, console, sizeof(console)))
+        rc = -5;
+    else if (f_read(&fil, ctx->health, size, &br) || (br != size))
+        rc = -3;
+    else if (crc32_compute((u8*)ctx->health, size) != hdr.crc)
+        rc = -4;
+
+    f_close(&fil);
+
+    ctx->health_valid = (rc == 0);
+    return rc;
+}
+
+int isfs_health_save(isfs_ctx* ctx)
+{
+    isfs_health_hdr hdr;
+    u32 size = isfs_health_blocks(ctx) * sizeof(isfs_block_health);
+    char path[0x20];
+    UINT bw = 0;
+    FIL fil;
+    int rc = 0;
+
+    if (!ctx->health_valid)
+        return -1;
+
+    hdr.magic = ISFS_HEALTH_MAGIC;
+    hdr.count = isfs_health_blocks(ctx);
+    hdr.crc = crc32_compute((u8*)ctx->health, size);
+    isfs_health_console(ctx, hdr.console);
+
+    isfs_health_path(ctx, path, sizeof(path));
+    if (f_open(&fil, path, FA_WRITE | FA_CREATE_ALWAYS))
+        return -2;
+
+    if (f_write(&fil, &hdr, sizeof(hdr), &bw) || (bw != sizeof(hdr)) ||
+        f_write(&fil, ctx->health, size, &bw) || (bw != size))
+        rc = -3;
+
+    f_close(&fil);
+    return rc;
+}
+
+int isfs_health_slot(isfs_ctx* ctx, u32 index)
+{
+    int rc = ISFS_HEALTH_GOOD;
+
+    if (!ctx->health_valid)
+        return ISFS_HEALTH_GOOD;
+
+    for (u32 b = 0; b < ISFSSUPER_BLOCKS; b++)
+    {
+        isfs_block_health* health = &ctx->health[index * ISFSSUPER_BLOCKS + b];
+
+        if (health->bad || health->write_errors ||
+            (health->read_errors >= ISFS_HEALTH_READ_ERRORS_BAD))
+            return ISFS_HEALTH_BAD;
+        if (health->ecc_corrected || health->read_errors)
+            rc = ISFS_HEALTH_WORN;
+    }
+
+    return rc;
+}
+
+void isfs_health_record_read(isfs_ctx* ctx, u32 index, int rc)
+{
+    if (!ctx->health_valid)
+        return;
+
+    /* the failing block isn't known, account both */
+    for (u32 b = 0; b < ISFSSUPER_BLOCKS; b++)
+    {
+        isfs_block_health* health = &ctx->health[index * ISFSSUPER_BLOCKS + b];
+
+        if (rc == ISFSVOL_ERROR_READ)
+            isfs_health_inc(&health->read_errors);
+        else if (rc == ISFSVOL_ECC_CORRECTED)
+            isfs_health_inc(&health->ecc_corrected);
+    }
+}
+
+void isfs_health_record_write(isfs_ctx* ctx, u32 index, int rc)
+{
+    if (!ctx->health_valid || (rc >= 0))
+        return;
+
+    for (u32 b = 0; b < ISFSSUPER_BLOCKS; b++)
+        isfs_health_inc(&ctx->health[index * ISFSSUPER_BLOCKS + b].write_errors);
+}
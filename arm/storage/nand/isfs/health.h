@@ -0,0 +1,23 @@
+#pragma once
+#include "isfs.h"
+
+#define ISFS_HEALTH_GOOD    0 // no issue ever seen
+#define ISFS_HEALTH_WORN    1 // usable, but needed ecc correction or failed a read once
+#define ISFS_HEALTH_BAD     2 // don't place superblocks here
+
+/* sweep the superblock region of a volume, this starts the table over
+ * and is the only way to clear recorded failures: a slot that failed a
+ * write stays bad until the next scan */
+int isfs_health_scan(isfs_ctx* ctx);
+
+/* load or store the health table on the sd card, tables built on
+ * another console are rejected */
+int isfs_health_load(isfs_ctx* ctx);
+int isfs_health_save(isfs_ctx* ctx);
+
+/* health of a superblock slot (the worst of its blocks) */
+int isfs_health_slot(isfs_ctx* ctx, u32 index);
+
+/* account the result of a superblock slot read or write */
+void isfs_health_record_read(isfs_ctx* ctx, u32 index, int rc);
+void isfs_health_record_write(isfs_ctx* ctx, u32 index, int rc);
@@ -15,15 +15,20 @@
 #include <string.h>
 #include <stdlib.h>
 #include <malloc.h>
+#include <errno.h>
+#include <fcntl.h>
 
 #include "storage/nand/nand.h"
 #include "storage/nand/isfs/isfs.h"
 #include "storage/nand/isfs/volume.h"
 #include "storage/nand/isfs/super.h"
+#include "storage/nand/isfs/cache.h"
 #include "storage/nand/isfs/isfshax.h"
 
 static bool initialized = false;
 
+static void isfs_devoptab_setup(isfs_ctx* ctx);
+
 int isfs_init(void)
 {
     isfs_ctx *ctx;
@@ -37,16 +42,37 @@ int isfs_init(void)
     ctx = isfs_get_volume(ISFSVOL_SLCCMPT);
     ctx->mounted = !isfs_load_super(ctx, 0, 0xffffffff);
 
+    /* make mounted volumes available to stdio as slc:/ and slccmpt:/ */
+    for(int i = 0; i < isfs_num_volumes(); i++)
+    {
+        ctx = isfs_get_volume(i);
+        if(!ctx->mounted) continue;
+
+        isfs_devoptab_setup(ctx);
+        AddDevice(&ctx->devoptab);
+    }
+
     initialized = true;
     return 0;
 }
 
 int isfs_fini(void)
 {
+    char name[sizeof(((isfs_ctx*)0)->name) + 1];
+
     if(!initialized) return 0;
 
     for(int i = 0; i < isfs_num_volumes(); i++)
-        isfs_get_volume(i)->mounted = false;
+    {
+        isfs_ctx* ctx = isfs_get_volume(i);
+
+        if(ctx->mounted)
+        {
+            sprintf(name, "%s:", ctx->name);
+            RemoveDevice(name);
+        }
+        ctx->mounted = false;
+    }
 
     initialized = false;
     return 0;
@@ -58,7 +84,7 @@ isfs_fst* isfs_stat(const char* path)
     path = isfs_do_volume(path, &ctx);
     if(!ctx || !path) return NULL;
 
-    return isfs_find_fst(ctx, NULL, path);
+    return isfs_lookup_path(ctx, path);
 }
 
 int isfs_open(isfs_file* file, const char* path)
@@ -69,7 +95,7 @@ int isfs_open(isfs_file* file, const char* path)
     path = isfs_do_volume(path, &ctx);
     if(!ctx) return -2;
 
-    isfs_fst* fst = isfs_find_fst(ctx, NULL, path);
+    isfs_fst* fst = isfs_lookup_path(ctx, path);
     if(!fst) return -3;
 
     if(!isfs_fst_is_file(fst)) return -4;
@@ -92,6 +118,39 @@ int isfs_close(isfs_file* file)
     return 0;
 }
 
+/* nand cluster holding cluster index of a file, optionally returning how
+ * many clusters are known to follow contiguously from it */
+static u16 isfs_file_cluster(isfs_ctx* ctx, isfs_file* file, u32 index, u32* contig)
+{
+    if(contig) *contig = 1;
+
+    if(file->runs) {
+        u32 lo = 0, hi = file->run_count;
+
+        /* find the last run starting at or before index */
+        while(hi - lo > 1) {
+            u32 mid = (lo + hi) / 2;
+            if(file->runs[mid].first <= index) lo = mid;
+            else hi = mid;
+        }
+
+        isfs_run* run = &file->runs[lo];
+        if(!file->run_count || index < run->first || index >= run->first + run->count)
+            return FAT_CLUSTER_LAST;
+
+        if(contig) *contig = run->first + run->count - index;
+        return run->start + (index - run->first);
+    }
+
+    u16* fat = isfs_get_fat(ctx);
+    u16 cluster = file->fst->sub;
+
+    while(index-- && cluster < CLUSTER_COUNT)
+        cluster = fat[cluster];
+
+    return cluster;
+}
+
 int isfs_seek(isfs_file* file, s32 offset, int whence)
 {
     if(!file) return -1;
@@ -120,17 +179,48 @@ int isfs_seek(isfs_file* file, s32 offset, int whence)
             break;
     }
 
-    u16 sub = fst->sub;
-    size_t size = file->offset;
+    file->cluster = isfs_file_cluster(ctx, file, file->offset / CLUSTER_SIZE, NULL);
 
-    while(size > 8 * PAGE_SIZE) {
-        sub = isfs_get_fat(ctx)[sub];
-        size -= 8 * PAGE_SIZE;
-    }
+    return 0;
+}
 
-    file->cluster = sub;
+int isfs_map(isfs_file* file, isfs_run* runs, u32 max)
+{
+    if(!file || !runs) return -1;
 
-    return 0;
+    isfs_ctx* ctx = isfs_get_volume(file->volume);
+    isfs_fst* fst = file->fst;
+    if(!ctx || !fst) return -2;
+
+    u16* fat = isfs_get_fat(ctx);
+    u32 clusters = (fst->size + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+    u32 n = 0, index = 0;
+    u16 cluster = fst->sub;
+
+    file->runs = NULL;
+    file->run_count = 0;
+
+    while(index < clusters) {
+        if(cluster >= CLUSTER_COUNT) return -4;
+        if(n >= max) return -5;
+
+        u32 count = 1;
+        while((index + count < clusters) && (cluster + count < CLUSTER_COUNT) &&
+              (fat[cluster + count - 1] == cluster + count))
+            count++;
+
+        runs[n].first = index;
+        runs[n].start = cluster;
+        runs[n].count = count;
+        n++;
+
+        index += count;
+        cluster = fat[cluster + count - 1];
+    }
+
+    file->runs = runs;
+    file->run_count = n;
+    return n;
 }
 
 int isfs_read(isfs_file* file, void* buffer, size_t size, size_t* bytes_read)
@@ -145,32 +235,58 @@ int isfs_read(isfs_file* file, void* buffer, size_t size, size_t* bytes_read)
         size = fst->size - file->offset;
 
     size_t total = size;
-
-    void* cluster_buf = memalign(64, CLUSTER_SIZE);
-    if(!cluster_buf) return -3;
+    u16* fat = isfs_get_fat(ctx);
 
     while(size) {
         size_t pos = file->offset % CLUSTER_SIZE;
-        size_t copy = CLUSTER_SIZE - pos;
-        if(copy > size) copy = size;
+        size_t copy;
 
-        if (isfs_read_volume(ctx, file->cluster, 1, ISFSVOL_FLAG_ENCRYPTED, NULL, cluster_buf) < 0)
-        {
-            free(cluster_buf);
+        if(file->cluster >= CLUSTER_COUNT)
             return -4;
+
+        if(!pos && size >= CLUSTER_SIZE && !((u32)buffer & 0x1f))
+        {
+            /* read whole clusters straight into the caller buffer,
+             * coalescing physically contiguous runs into one request */
+            u32 start = file->cluster, count = 1;
+            if(file->runs) {
+                isfs_file_cluster(ctx, file, file->offset / CLUSTER_SIZE, &count);
+                if(count > size / CLUSTER_SIZE) count = size / CLUSTER_SIZE;
+            } else {
+                while(((count + 1) * CLUSTER_SIZE <= size) &&
+                      (fat[start + count - 1] == start + count))
+                    count++;
+            }
+
+            if (isfs_read_volume(ctx, start, count, ISFSVOL_FLAG_ENCRYPTED, NULL, buffer) < 0)
+                return -4;
+
+            copy = count * CLUSTER_SIZE;
+            if(file->runs)
+                file->cluster = isfs_file_cluster(ctx, file, file->offset / CLUSTER_SIZE + count, NULL);
+            else
+                file->cluster = fat[start + count - 1];
+        }
+        else
+        {
+            /* partial cluster, go through the cluster cache */
+            copy = CLUSTER_SIZE - pos;
+            if(copy > size) copy = size;
+
+            const u8* cluster_buf = isfs_cache_get(ctx, file->cluster);
+            if(!cluster_buf) return -4;
+
+            memcpy(buffer, cluster_buf + pos, copy);
+
+            if((pos + copy) >= CLUSTER_SIZE)
+                file->cluster = fat[file->cluster];
         }
-        memcpy(buffer, cluster_buf + pos, copy);
 
         file->offset += copy;
         buffer += copy;
         size -= copy;
-
-        if((pos + copy) >= CLUSTER_SIZE)
-            file->cluster = isfs_get_fat(ctx)[file->cluster];
     }
 
-    free(cluster_buf);
-
     *bytes_read = total;
     return 0;
 }
@@ -183,7 +299,7 @@ int isfs_diropen(isfs_dir* dir, const char* path)
     path = isfs_do_volume(path, &ctx);
     if(!ctx) return -2;
 
-    isfs_fst* fst = isfs_find_fst(ctx, NULL, path);
+    isfs_fst* fst = isfs_lookup_path(ctx, path);
     if(!fst) return -3;
 
     if(!isfs_fst_is_dir(fst)) return -4;
@@ -238,3 +354,293 @@ int isfs_dirclose(isfs_dir* dir)
 
     return 0;
 }
+
+/* devoptab glue, sequential reads are served from a read-ahead window */
+#define ISFS_READAHEAD_CLUSTERS 4
+#define ISFS_READAHEAD_SIZE     (ISFS_READAHEAD_CLUSTERS * CLUSTER_SIZE)
+
+typedef struct isfs_devfile {
+    isfs_file file;
+    size_t pos;         // position seen by stdio
+    size_t next;        // where a sequential read would continue
+    isfs_run* runs;
+    u8* window;
+    size_t window_start, window_len;
+} isfs_devfile;
+
+static void isfs_fst_to_stat(isfs_ctx* ctx, isfs_fst* fst, struct stat* st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_ino = fst - isfs_get_fst(ctx);
+    st->st_mode = isfs_fst_is_dir(fst) ? (S_IFDIR | 0555) : (S_IFREG | 0444);
+    st->st_nlink = 1;
+    st->st_uid = fst->uid;
+    st->st_gid = fst->gid;
+    st->st_size = isfs_fst_is_file(fst) ? fst->size : 0;
+    st->st_blksize = CLUSTER_SIZE;
+    st->st_blocks = (st->st_size + 511) / 512;
+}
+
+static int _ISFS_open_r(struct _reent* r, void* fileStruct, const char* path, int flags, int mode)
+{
+    isfs_devfile* fp = (isfs_devfile*) fileStruct;
+
+    if((flags & O_ACCMODE) != O_RDONLY)
+    {
+        r->_errno = EROFS;
+        return -1;
+    }
+
+    memset(fp, 0, sizeof(*fp));
+    switch(isfs_open(&fp->file, path))
+    {
+        case 0:
+            break;
+        case -4:
+            r->_errno = EISDIR;
+            return -1;
+        default:
+            r->_errno = ENOENT;
+            return -1;
+    }
+
+    /* every window refill seeks, map the file so that doesn't walk the fat */
+    u32 clusters = (fp->file.fst->size + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+    fp->runs = malloc((clusters ? clusters : 1) * sizeof(isfs_run));
+    fp->window = memalign(64, ISFS_READAHEAD_SIZE);
+    if(!fp->runs || !fp->window)
+    {
+        free(fp->runs);
+        free(fp->window);
+        r->_errno = ENOMEM;
+        return -1;
+    }
+
+    if(isfs_map(&fp->file, fp->runs, clusters ? clusters : 1) < 0)
+    {
+        free(fp->runs);
+        free(fp->window);
+        r->_errno = EIO;
+        return -1;
+    }
+
+    return (int) fp;
+}
+
+static int _ISFS_close_r(struct _reent* r, void* fd)
+{
+    isfs_devfile* fp = (isfs_devfile*) fd;
+
+    free(fp->window);
+    free(fp->runs);
+    isfs_close(&fp->file);
+    return 0;
+}
+
+/* read from a position of the file through isfs_read */
+static int _ISFS_read_at(isfs_devfile* fp, size_t pos, void* ptr, size_t len, size_t* done)
+{
+    *done = 0;
+    if(isfs_seek(&fp->file, pos, SEEK_SET) < 0) return -1;
+    return isfs_read(&fp->file, ptr, len, done);
+}
+
+static ssize_t _ISFS_read_r(struct _reent* r, void* fd, char* ptr, size_t len)
+{
+    isfs_devfile* fp = (isfs_devfile*) fd;
+    size_t size = fp->file.fst->size, total = 0, n;
+    bool sequential = (fp->pos == fp->next);
+
+    if(fp->pos >= size) return 0;
+    if(len > size - fp->pos) len = size - fp->pos;
+
+    while(len)
+    {
+        if(fp->pos >= fp->window_start && fp->pos < fp->window_start + fp->window_len)
+        {
+            /* hit in the read-ahead window */
+            n = fp->window_start + fp->window_len - fp->pos;
+            if(n > len) n = len;
+            memcpy(ptr, fp->window + (fp->pos - fp->window_start), n);
+        }
+        else if(len >= ISFS_READAHEAD_SIZE && !(fp->pos % CLUSTER_SIZE))
+        {
+            /* large reads go straight to the caller buffer */
+            if(_ISFS_read_at(fp, fp->pos, ptr, len - len % CLUSTER_SIZE, &n) < 0 || !n)
+                break;
+        }
+        else
+        {
+            /* refill the window, only reading ahead for sequential access */
+            size_t start = fp->pos - fp->pos % CLUSTER_SIZE;
+            size_t want = sequential ? ISFS_READAHEAD_SIZE : CLUSTER_SIZE;
+            if(want > size - start) want = size - start;
+
+            fp->window_len = 0;
+            if(_ISFS_read_at(fp, start, fp->window, want, &n) < 0 || !n)
+                break;
+
+            fp->window_start = start;
+            fp->window_len = n;
+            continue;
+        }
+
+        fp->pos += n;
+        ptr += n;
+        len -= n;
+        total += n;
+    }
+
+    if(!total && len)
+    {
+        r->_errno = EIO;
+        return -1;
+    }
+
+    fp->next = fp->pos;
+    return total;
+}
+
+static off_t _ISFS_seek_r(struct _reent* r, void* fd, off_t pos, int dir)
+{
+    isfs_devfile* fp = (isfs_devfile*) fd;
+    off_t off;
+
+    switch(dir)
+    {
+        case SEEK_SET:
+            off = pos;
+            break;
+        case SEEK_CUR:
+            off = fp->pos + pos;
+            break;
+        case SEEK_END:
+            off = fp->file.fst->size + pos;
+            break;
+        default:
+            r->_errno = EINVAL;
+            return -1;
+    }
+
+    if(off < 0 || off > fp->file.fst->size)
+    {
+        r->_errno = EINVAL;
+        return -1;
+    }
+
+    fp->pos = off;
+    return off;
+}
+
+static int _ISFS_fstat_r(struct _reent* r, void* fd, struct stat* st)
+{
+    isfs_devfile* fp = (isfs_devfile*) fd;
+
+    isfs_fst_to_stat(isfs_get_volume(fp->file.volume), fp->file.fst, st);
+    return 0;
+}
+
+static int _ISFS_stat_r(struct _reent* r, const char* file, struct stat* st)
+{
+    isfs_ctx* ctx = NULL;
+    const char* path = isfs_do_volume(file, &ctx);
+    isfs_fst* fst = (ctx && path) ? isfs_lookup_path(ctx, path) : NULL;
+
+    if(!fst)
+    {
+        r->_errno = ENOENT;
+        return -1;
+    }
+
+    isfs_fst_to_stat(ctx, fst, st);
+    return 0;
+}
+
+static DIR_ITER* _ISFS_diropen_r(struct _reent* r, DIR_ITER* dirState, const char* path)
+{
+    isfs_dir* dir = (isfs_dir*) dirState->dirStruct;
+    isfs_ctx* ctx = NULL;
+
+    path = isfs_do_volume(path, &ctx);
+    isfs_fst* fst = (ctx && path) ? isfs_lookup_path(ctx, path) : NULL;
+
+    if(!fst)
+    {
+        r->_errno = ENOENT;
+        return NULL;
+    }
+    if(!isfs_fst_is_dir(fst))
+    {
+        r->_errno = ENOTDIR;
+        return NULL;
+    }
+
+    memset(dir, 0, sizeof(isfs_dir));
+    dir->volume = ctx->volume;
+    dir->dir = fst;
+    dir->child = (fst->sub != 0xFFFF) ? &isfs_get_fst(ctx)[fst->sub] : NULL;
+
+    return dirState;
+}
+
+static int _ISFS_dirreset_r(struct _reent* r, DIR_ITER* dirState)
+{
+    isfs_dir* dir = (isfs_dir*) dirState->dirStruct;
+
+    if(dir->dir->sub == 0xFFFF)
+        dir->child = NULL;
+    else
+        isfs_dirreset(dir);
+
+    return 0;
+}
+
+static int _ISFS_dirnext_r(struct _reent* r, DIR_ITER* dirState, char* filename, struct stat* st)
+{
+    isfs_dir* dir = (isfs_dir*) dirState->dirStruct;
+    isfs_fst* fst = NULL;
+
+    if(isfs_dirread(dir, &fst) < 0 || !fst)
+    {
+        r->_errno = ENOENT;
+        return -1;
+    }
+
+    memcpy(filename, fst->name, sizeof(fst->name));
+    filename[sizeof(fst->name)] = '\0';
+
+    if(st)
+        isfs_fst_to_stat(isfs_get_volume(dir->volume), fst, st);
+
+    return 0;
+}
+
+static int _ISFS_dirclose_r(struct _reent* r, DIR_ITER* dirState)
+{
+    isfs_dirclose((isfs_dir*) dirState->dirStruct);
+    return 0;
+}
+
+static void isfs_devoptab_setup(isfs_ctx* ctx)
+{
+    devoptab_t* dotab = &ctx->devoptab;
+
+    memset(dotab, 0, sizeof(devoptab_t));
+    dotab->name = ctx->name;
+    dotab->deviceData = ctx;
+    dotab->structSize = sizeof(isfs_devfile);
+    dotab->dirStateSize = sizeof(isfs_dir);
+
+    dotab->open_r = _ISFS_open_r;
+    dotab->close_r = _ISFS_close_r;
+    dotab->read_r = _ISFS_read_r;
+    dotab->seek_r = _ISFS_seek_r;
+
+    dotab->fstat_r = _ISFS_fstat_r;
+    dotab->stat_r = _ISFS_stat_r;
+
+    dotab->diropen_r = _ISFS_diropen_r;
+    dotab->dirreset_r = _ISFS_dirreset_r;
+    dotab->dirnext_r = _ISFS_dirnext_r;
+    dotab->dirclose_r = _ISFS_dirclose_r;
+}
@@ -23,6 +23,13 @@ typedef struct isfs_ctx {
     const u32 super_count;
     int index;
     u8* super;
+    isfs_slot* slots;
+    bool scanned;
+    isfs_block_health* health;
+    bool health_valid;
+    u16* fst_index;
+    u16* fst_parent;
+    bool fst_indexed;
     u32 generation;
     u32 version;
     bool mounted;
@@ -31,11 +38,20 @@ typedef struct isfs_ctx {
     devoptab_t devoptab;
 } isfs_ctx;
 
+/* physically contiguous clusters of a file */
+typedef struct isfs_run {
+    u32 first;  // index of the first cluster within the file
+    u16 start;  // first cluster on nand
+    u16 count;
+} isfs_run;
+
 typedef struct isfs_file {
     int volume;
     isfs_fst* fst;
     size_t offset;
     u16 cluster;
+    isfs_run* runs;
+    u32 run_count;
 } isfs_file;
 
 typedef struct isfs_dir {
@@ -55,6 +71,11 @@ int isfs_close(isfs_file* file);
 int isfs_seek(isfs_file* file, s32 offset, int whence);
 int isfs_read(isfs_file* file, void* buffer, size_t size, size_t* bytes_read);
 
+/* map the clusters of an open file into runs (max entries), making seeks
+ * O(log runs) and letting reads use whole extents; returns the number of
+ * runs or -5 (file left unmapped) if they don't fit */
+int isfs_map(isfs_file* file, isfs_run* runs, u32 max);
+
 int isfs_diropen(isfs_dir* dir, const char* path);
 int isfs_dirread(isfs_dir* dir, isfs_fst** info);
 int isfs_dirreset(isfs_dir* dir);
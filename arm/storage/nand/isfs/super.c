@@ -21,6 +21,8 @@
 #include "volume.h"
 #include "hmac.h"
 #include "super.h"
+#include "health.h"
+#include "cache.h"
 
 int isfs_get_super_version(void* buffer)
 {
@@ -108,6 +110,100 @@ bool isfs_fst_is_dir(const isfs_fst* fst)
     return isfs_fst_get_type(fst) == 2;
 }
 
+/* fst names are padded with zeroes unless they use all 12 bytes */
+static size_t isfs_fst_name_len(const isfs_fst* fst)
+{
+    const char* end = memchr(fst->name, '\0', sizeof(fst->name));
+    return end ? (size_t)(end - fst->name) : sizeof(fst->name);
+}
+
+static u32 isfs_fst_hash(u16 parent, const char* name, size_t len)
+{
+    u32 hash = 2166136261u ^ parent;
+
+    while(len--)
+        hash = (hash ^ (u8)*name++) * 16777619u;
+
+    return hash ^ (hash >> 15);
+}
+
+static u16 isfs_fst_lookup(isfs_ctx* ctx, u16 parent, const char* name, size_t len)
+{
+    isfs_fst* root = isfs_get_fst(ctx);
+    u32 slot = isfs_fst_hash(parent, name, len) & (ISFS_FST_INDEX_SIZE - 1);
+    u16 i;
+
+    while((i = ctx->fst_index[slot]) != 0xFFFF)
+    {
+        if(ctx->fst_parent[i] == parent && isfs_fst_name_len(&root[i]) == len &&
+           !memcmp(root[i].name, name, len))
+            return i;
+
+        slot = (slot + 1) & (ISFS_FST_INDEX_SIZE - 1);
+    }
+
+    return 0xFFFF;
+}
+
+static void isfs_fst_insert(isfs_ctx* ctx, u16 parent, u16 entry)
+{
+    isfs_fst* root = isfs_get_fst(ctx);
+    size_t len = isfs_fst_name_len(&root[entry]);
+    u32 slot = isfs_fst_hash(parent, root[entry].name, len) & (ISFS_FST_INDEX_SIZE - 1);
+    u16 i;
+
+    while((i = ctx->fst_index[slot]) != 0xFFFF)
+    {
+        /* duplicate names: like the old sibling walk, the last one wins */
+        if(ctx->fst_parent[i] == parent && isfs_fst_name_len(&root[i]) == len &&
+           !memcmp(root[i].name, root[entry].name, len))
+            break;
+
+        slot = (slot + 1) & (ISFS_FST_INDEX_SIZE - 1);
+    }
+
+    ctx->fst_index[slot] = entry;
+}
+
+int isfs_index_fst(isfs_ctx* ctx)
+{
+    static u16 queue[ISFS_FST_COUNT];
+    isfs_fst* root = isfs_get_fst(ctx);
+    u32 head = 0, tail = 0;
+
+    memset(ctx->fst_index, 0xFF, ISFS_FST_INDEX_SIZE * sizeof(u16));
+    memset(ctx->fst_parent, 0xFF, ISFS_FST_COUNT * sizeof(u16));
+    ctx->fst_indexed = false;
+
+    if(!isfs_fst_is_dir(&root[0]))
+        return -1;
+
+    /* walk the tree breadth first, an entry is visited once it has a parent */
+    ctx->fst_parent[0] = 0;
+    queue[tail++] = 0;
+
+    while(head < tail)
+    {
+        u16 dir = queue[head++];
+
+        for(u16 i = root[dir].sub; i != 0xFFFF; i = root[i].sib)
+        {
+            /* corrupted chains */
+            if(i >= ISFS_FST_COUNT || ctx->fst_parent[i] != 0xFFFF)
+                break;
+
+            ctx->fst_parent[i] = dir;
+            isfs_fst_insert(ctx, dir, i);
+
+            if(isfs_fst_is_dir(&root[i]))
+                queue[tail++] = i;
+        }
+    }
+
+    ctx->fst_indexed = true;
+    return 0;
+}
+
 isfs_fst* isfs_find_fst(isfs_ctx* ctx, isfs_fst* fst, const char* path)
 {
     isfs_fst* root = isfs_get_fst(ctx);
@@ -131,9 +227,43 @@ isfs_fst* isfs_find_fst(isfs_ctx* ctx, isfs_fst* fst, const char* path)
     return NULL;
 }
 
+isfs_fst* isfs_lookup_path(isfs_ctx* ctx, const char* path)
+{
+    isfs_fst* root = isfs_get_fst(ctx);
+    u16 cur = 0;
+
+    if(!ctx->fst_indexed && isfs_index_fst(ctx) < 0)
+        return NULL;
+
+    if(*path != '/')
+        return NULL;
+
+    while(*path)
+    {
+        while(*path == '/') path++;
+        if(!*path) break;
+
+        size_t len = strcspn(path, "/");
+        if(len > sizeof(root->name)) return NULL;
+        if(!isfs_fst_is_dir(&root[cur])) return NULL;
+
+        cur = isfs_fst_lookup(ctx, cur, path, len);
+        if(cur == 0xFFFF) return NULL;
+
+        path += len;
+    }
+
+    return &root[cur];
+}
+
+static u32 isfs_super_cluster(isfs_ctx *ctx, u32 index)
+{
+    return CLUSTER_COUNT - (ctx->super_count - index) * ISFSSUPER_CLUSTERS;
+}
+
 int isfs_super_check_slot(isfs_ctx *ctx, u32 index)
 {
-    u32 offs, cluster = CLUSTER_COUNT - (ctx->super_count - index) * ISFSSUPER_CLUSTERS;
+    u32 offs, cluster = isfs_super_cluster(ctx, index);
     u16* fat = isfs_get_fat(ctx);
 
     for (offs = 0; offs < ISFSSUPER_CLUSTERS; offs++)
@@ -145,7 +275,7 @@ int isfs_super_check_slot(isfs_ctx *ctx, u32 index)
 
 int isfs_super_mark_bad_slot(isfs_ctx *ctx, u32 index)
 {
-    u32 offs, cluster = CLUSTER_COUNT - (ctx->super_count - index) * ISFSSUPER_CLUSTERS;
+    u32 offs, cluster = isfs_super_cluster(ctx, index);
     u16* fat = isfs_get_fat(ctx);
 
     for (offs = 0; offs < ISFSSUPER_CLUSTERS; offs++)
@@ -156,52 +286,184 @@ int isfs_super_mark_bad_slot(isfs_ctx *ctx, u32 index)
 
 int isfs_read_super(isfs_ctx *ctx, void *super, int index)
 {
-    u32 cluster = CLUSTER_COUNT - (ctx->super_count - index) * ISFSSUPER_CLUSTERS;
+    u32 cluster = isfs_super_cluster(ctx, index);
     isfs_hmac_meta seed = { .cluster = cluster };
-    return isfs_read_volume(ctx, cluster, ISFSSUPER_CLUSTERS, ISFSVOL_FLAG_HMAC, &seed, super);
+    int rc = isfs_read_volume(ctx, cluster, ISFSSUPER_CLUSTERS, ISFSVOL_FLAG_HMAC, &seed, super);
+
+    isfs_health_record_read(ctx, index, rc);
+    return rc;
 }
 
 int isfs_write_super(isfs_ctx *ctx, void *super, int index)
 {
-    u32 cluster = CLUSTER_COUNT - (ctx->super_count - index) * ISFSSUPER_CLUSTERS;
+    u32 cluster = isfs_super_cluster(ctx, index);
     isfs_hmac_meta seed = { .cluster = cluster };
-    return isfs_write_volume(ctx, cluster, ISFSSUPER_CLUSTERS, ISFSVOL_FLAG_HMAC | ISFSVOL_FLAG_READBACK, &seed, super);
+    int rc = isfs_write_volume(ctx, cluster, ISFSSUPER_CLUSTERS, ISFSVOL_FLAG_HMAC | ISFSVOL_FLAG_READBACK, &seed, super);
+
+    isfs_health_record_write(ctx, index, rc);
+
+    /* keep the slot index in sync with what is now on nand */
+    if (ctx->scanned)
+    {
+        ctx->slots[index].version = (rc >= 0) ? isfs_get_super_version(super) : -1;
+        ctx->slots[index].generation = isfs_get_super_generation(super);
+        ctx->slots[index].status = (ctx->slots[index].status & ISFS_SLOT_BAD_BLOCK) |
+                                   ((rc >= 0) ? 0 : ISFS_SLOT_READ_ERROR);
+    }
+
+    return rc;
 }
 
-int isfs_find_super(isfs_ctx* ctx, u32 min_generation, u32 max_generation, u32 *generation, u32 *version)
+int isfs_erase_super(isfs_ctx *ctx, int index)
+{
+    u32 block = isfs_super_cluster(ctx, index) / BLOCK_CLUSTERS;
+    int rc = 0;
+
+    if (nand_batch_begin(ctx->bank, 1) >= 0)
+    {
+        for (u32 b = 0; b < ISFSSUPER_BLOCKS; b++)
+            if (nand_erase_block(block + b) < 0)
+                rc = -1;
+    }
+    else rc = -1;
+    nand_batch_end();
+
+    if (ctx->scanned)
+    {
+        ctx->slots[index].version = -1;
+        ctx->slots[index].generation = 0;
+        ctx->slots[index].status = (ctx->slots[index].status & ISFS_SLOT_BAD_BLOCK) |
+                                   (rc ? ISFS_SLOT_READ_ERROR : 0);
+    }
+
+    return rc;
+}
+
+static int isfs_do_scan_super(isfs_ctx* ctx)
+{
+    static u8 page[2][PAGE_SIZE] ALIGNED(64);
+    u8 spare[SPARE_SIZE], pending[64];
+    int i, j, count = 0;
+
+    /* the spares tell factory bad and erased slots apart without
+     * transferring the header pages */
+    for (i = 0; i < ctx->super_count; i++)
+    {
+        isfs_slot* slot = &ctx->slots[i];
+        u32 block = isfs_super_cluster(ctx, i) / BLOCK_CLUSTERS;
+
+        slot->status = 0;
+        slot->version = -1;
+        slot->generation = 0;
+
+        /* an unreadable marker isn't a factory bad block */
+        for (j = 0; j < ISFSSUPER_BLOCKS; j++)
+        {
+            int bad = nand_block_is_bad(block + j);
+            if (bad > 0)
+                slot->status |= ISFS_SLOT_BAD_BLOCK;
+            else if (bad < 0)
+                slot->status |= ISFS_SLOT_SPARE_ERROR;
+        }
+        if (slot->status)
+            continue;
+
+        if (nand_read_spare(block * BLOCK_PAGES, spare) < 0)
+        {
+            slot->status = ISFS_SLOT_READ_ERROR;
+            continue;
+        }
+
+        /* a programmed page always carries ecc */
+        for (j = 0x30; (j < SPARE_SIZE) && (spare[j] == 0xff); j++);
+        if (j < SPARE_SIZE)
+            pending[count++] = i;
+    }
+
+    if (!count)
+        goto done;
+
+    /* read the header page of the written slots, keeping the next read in flight */
+    if (nand_read_page_start(isfs_super_cluster(ctx, pending[0]) * CLUSTER_PAGES, page[0]) < 0)
+        return -1;
+
+    for (i = 0; i < count; i++)
+    {
+        isfs_slot* slot = &ctx->slots[pending[i]];
+        u8* hdr = page[i & 1];
+        int res;
+
+        if (((i + 1) < count) &&
+            (nand_read_page_start(isfs_super_cluster(ctx, pending[i + 1]) * CLUSTER_PAGES, page[(i + 1) & 1]) < 0))
+        {
+            nand_read_abort();
+            return -1;
+        }
+
+        res = nand_read_page_finish(hdr, NULL);
+
+        if (res < 0) {
+            slot->status = ISFS_SLOT_READ_ERROR;
+            continue;
+        }
+        if (res > 0)
+            slot->status = ISFS_SLOT_ECC_CORRECTED;
+
+        slot->version = isfs_get_super_version(hdr);
+        slot->generation = isfs_get_super_generation(hdr);
+    }
+
+done:
+    ctx->scanned = true;
+    return 0;
+}
+
+int isfs_scan_super(isfs_ctx* ctx)
+{
+    int rc = -1;
+
+    if (nand_batch_begin(ctx->bank, 0) >= 0)
+        rc = isfs_do_scan_super(ctx);
+    nand_batch_end();
+    return rc;
+}
+
+void isfs_invalidate_super(isfs_ctx* ctx)
 {
-    void* super = memalign(64, CLUSTER_SIZE);
-    if(!super) return -1;
+    /* the nand was rewritten underneath, rescan the slots on the next load */
+    ctx->scanned = false;
+    ctx->fst_indexed = false;
+    isfs_cache_invalidate(ctx, 0, 0);
+}
 
+int isfs_find_super(isfs_ctx* ctx, u32 min_generation, u32 max_generation, u32 *generation, u32 *version)
+{
     struct {
         int index;
         u32 generation;
         u8 version;
     } newest = {-1, 0, 0};
 
+    if(!ctx->scanned && isfs_scan_super(ctx) < 0)
+        return -1;
+
     for(int i = 0; i < ctx->super_count; i++)
     {
-        u32 cluster = CLUSTER_COUNT - (ctx->super_count - i) * ISFSSUPER_CLUSTERS;
-
-        if(isfs_read_volume(ctx, cluster, 1, 0, NULL, super)<0)
-            continue;
+        isfs_slot* slot = &ctx->slots[i];
 
-        int cur_version = isfs_get_super_version(super);
-        if(cur_version < 0) continue;
+        if(slot->version < 0) continue;
+        if(slot->status & (ISFS_SLOT_READ_ERROR | ISFS_SLOT_HMAC_ERROR | ISFS_SLOT_BAD_BLOCK)) continue;
 
-        u32 cur_generation = isfs_get_super_generation(super);
-        if((cur_generation < newest.generation) ||
-           (cur_generation < min_generation) ||
-           (cur_generation >= max_generation))
+        if((slot->generation < newest.generation) ||
+           (slot->generation < min_generation) ||
+           (slot->generation >= max_generation))
             continue;
 
         newest.index = i;
-        newest.generation = cur_generation;
-        newest.version = cur_version;
+        newest.generation = slot->generation;
+        newest.version = slot->version;
     }
 
-    free(super);
-
     if(newest.index == -1)
     {
         ISFS_debug("Failed to find super block.\n");
@@ -218,17 +480,26 @@ int isfs_find_super(isfs_ctx* ctx, u32 min_generation, u32 max_generation, u32 *
 
 int isfs_load_super(isfs_ctx* ctx, u32 min_generation, u32 max_generation)
 {
-    ctx->generation = max_generation;
-
-    while((ctx->index = isfs_find_super(ctx, min_generation, ctx->generation, &ctx->generation, &ctx->version)) >= 0)
+    while((ctx->index = isfs_find_super(ctx, min_generation, max_generation, &ctx->generation, &ctx->version)) >= 0)
+    {
+        ctx->fst_indexed = false;
         if(isfs_read_super(ctx, ctx->super, ctx->index) >= 0)
+        {
+            isfs_index_fst(ctx);
             break;
+        }
+
+        /* don't consider this slot again */
+        ctx->slots[ctx->index].status |= ISFS_SLOT_HMAC_ERROR;
+    }
 
     return (ctx->index >= 0) ? 0 : -1;
 }
 
 int isfs_commit_super(isfs_ctx* ctx)
 {
+    /* the new fat may place file data anywhere */
+    isfs_cache_invalidate(ctx, 0, 0);
     isfs_get_hdr(ctx)->generation++;
 
     for(int i = 1; i < ctx->super_count; i++)
@@ -238,6 +509,10 @@ int isfs_commit_super(isfs_ctx* ctx)
         if (isfs_super_check_slot(ctx, index) < 0)
             continue;
 
+        /* known to fail, don't bother trying */
+        if (isfs_health_slot(ctx, index) == ISFS_HEALTH_BAD)
+            continue;
+
         if (isfs_write_super(ctx, ctx->super, index) >= 0)
             return 0;
 
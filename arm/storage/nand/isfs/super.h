@@ -6,6 +6,9 @@
 #define ISFSSUPER_SIZE      (ISFSSUPER_CLUSTERS * CLUSTER_SIZE)
 #define ISFSSUPER_BLOCKS    2
 
+#define ISFS_FST_COUNT      6143
+#define ISFS_FST_INDEX_SIZE 0x2000 // hash slots, a power of two above ISFS_FST_COUNT
+
 typedef struct isfs_fst {
     char name[12];
     u8 mode;
@@ -30,7 +33,7 @@ _Static_assert(sizeof(isfs_hdr) == 0xC, "isfs_hdr size must be 0xC!");
 typedef struct isfs_super {
     isfs_hdr hdr;
     u16 fat[CLUSTER_COUNT];
-    isfs_fst fst[6143];
+    isfs_fst fst[ISFS_FST_COUNT];
     u8 pad[20];
 } PACKED ALIGNED(64) isfs_super;
 _Static_assert(sizeof(isfs_super) == ISFSSUPER_SIZE, "isfs_super must be 0x40000");
@@ -40,6 +43,27 @@ _Static_assert(sizeof(isfs_super) == ISFSSUPER_SIZE, "isfs_super must be 0x40000
 #define FAT_CLUSTER_BAD         0xFFFD // bad block (marked at factory)
 #define FAT_CLUSTER_EMPTY       0xFFFE // empty (unused / available) space
 
+/* cached superblock slot header, see isfs_scan_super */
+typedef struct isfs_slot {
+    u32 generation;
+    s8 version;
+    u8 status;
+} isfs_slot;
+
+#define ISFS_SLOT_ECC_CORRECTED     1 // header page needed ecc correction
+#define ISFS_SLOT_READ_ERROR        2 // header page couldn't be read
+#define ISFS_SLOT_HMAC_ERROR        4 // superblock failed hmac verification
+#define ISFS_SLOT_BAD_BLOCK         8 // a slot block carries a factory bad block marker
+#define ISFS_SLOT_SPARE_ERROR       16 // the bad block marker of a slot block couldn't be read
+
+/* health of a block in the superblock region, see health.c */
+typedef struct isfs_block_health {
+    u8 bad;             // factory bad block marker
+    u8 ecc_corrected;   // pages that needed ecc correction
+    u8 read_errors;     // uncorrectable reads
+    u8 write_errors;    // failed programs or readbacks
+} PACKED isfs_block_health;
+
 typedef struct isfs_ctx isfs_ctx;
 
 int isfs_get_super_version(void* buffer);
@@ -54,6 +78,13 @@ void isfs_print_fst(isfs_fst* fst);
 int isfs_fst_get_type(const isfs_fst* fst);
 bool isfs_fst_is_file(const isfs_fst* fst);
 bool isfs_fst_is_dir(const isfs_fst* fst);
+
+/* (parent, name) hash index of the fst, built when a superblock is loaded */
+int isfs_index_fst(isfs_ctx* ctx);
+/* resolve an absolute path through the index */
+isfs_fst* isfs_lookup_path(isfs_ctx* ctx, const char* path);
+/* resolve a path by walking the sibling chain starting at fst (the root
+ * when NULL) without the index, prefer isfs_lookup_path */
 isfs_fst* isfs_find_fst(isfs_ctx* ctx, isfs_fst* fst, const char* path);
 
 int isfs_super_check_slot(isfs_ctx *ctx, u32 index);
@@ -61,7 +92,12 @@ int isfs_super_mark_bad_slot(isfs_ctx *ctx, u32 index);
 
 int isfs_read_super(isfs_ctx *ctx, void *super, int index);
 int isfs_write_super(isfs_ctx *ctx, void *super, int index);
+int isfs_erase_super(isfs_ctx *ctx, int index);
 
+int isfs_scan_super(isfs_ctx* ctx);
+/* drop the slot scan, fst index and cached clusters of a volume, e.g. after
+ * a restore; the superblock must be loaded again before use */
+void isfs_invalidate_super(isfs_ctx* ctx);
 int isfs_find_super(isfs_ctx* ctx, u32 min_generation, u32 max_generation, u32 *generation, u32 *version);
 int isfs_load_super(isfs_ctx* ctx, u32 min_generation, u32 max_generation);
 int isfs_commit_super(isfs_ctx* ctx);
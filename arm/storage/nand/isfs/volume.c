@@ -2,6 +2,8 @@
 #include "isfs.h"
 #include "volume.h"
 #include "super.h"
+#include "health.h"
+#include "cache.h"
 
 #include "crypto/crypto.h"
 #include "crypto/aes.h"
@@ -9,8 +11,20 @@
 #include "string.h"
 
 static u8
-    slc_super_buf[ISFSSUPER_SIZE],
-    slccmpt_super_buf[ISFSSUPER_SIZE];
+    slc_super_buf[ISFSSUPER_SIZE] ALIGNED(64),
+    slccmpt_super_buf[ISFSSUPER_SIZE] ALIGNED(64);
+
+static isfs_slot
+    slc_slots[64],
+    slccmpt_slots[16];
+
+static isfs_block_health
+    slc_health[64 * ISFSSUPER_BLOCKS],
+    slccmpt_health[16 * ISFSSUPER_BLOCKS];
+
+static u16
+    slc_fst_index[ISFS_FST_INDEX_SIZE], slc_fst_parent[ISFS_FST_COUNT],
+    slccmpt_fst_index[ISFS_FST_INDEX_SIZE], slccmpt_fst_parent[ISFS_FST_COUNT];
 
 isfs_ctx isfs[4] = {
     [ISFSVOL_SLC]
@@ -22,6 +36,10 @@ isfs_ctx isfs[4] = {
         .hmac = &otp.nand_hmac,
         .super_count = 64,
         .super = slc_super_buf,
+        .slots = slc_slots,
+        .health = slc_health,
+        .fst_index = slc_fst_index,
+        .fst_parent = slc_fst_parent,
     },
     [ISFSVOL_SLCCMPT]
     {
@@ -32,6 +50,10 @@ isfs_ctx isfs[4] = {
         .hmac = &otp.wii_nand_hmac,
         .super_count = 16,
         .super = slccmpt_super_buf,
+        .slots = slccmpt_slots,
+        .health = slccmpt_health,
+        .fst_index = slccmpt_fst_index,
+        .fst_parent = slccmpt_fst_parent,
     },
 };
 
@@ -75,76 +97,147 @@ char* isfs_do_volume(const char* path, isfs_ctx** ctx)
     return NULL;
 }
 
-int isfs_read_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count, u32 flags, void *hmac_seed, void *data)
+static int isfs_do_read_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count, u32 flags, void *hmac_seed, void *data)
 {
+    static const u8 blank_hmac[20] = {
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    };
     u8 saved_hmacs[2][20] = {0}, hmac[20] = {0};
+    hmac_ctx calc_hmac;
+    aes_req reqs[2], *prev = NULL;
     int rc = ISFSVOL_OK;
+    u32 first_page = start_cluster * CLUSTER_PAGES;
+    u32 page_count = cluster_count * CLUSTER_PAGES;
+    u8 *page_data = (u8 *)data;
     u32 i, p;
 
-    /* enable slc or slccmpt bank */
-    nand_enable_banks(ctx->bank);
+    /* setup clusters decryption, every cluster starts with an empty iv */
+    if (flags & ISFSVOL_FLAG_ENCRYPTED)
+    {
+        aes_reset();
+        aes_set_key(ctx->key);
+        aes_empty_iv();
+    }
+
+    /* hash the data as it arrives, the verdict is ready with the last page */
+    if (flags & ISFSVOL_FLAG_HMAC)
+    {
+        u32 last_page = first_page + page_count - CLUSTER_PAGES;
+        u8 spare[SPARE_SIZE];
+
+        /* pages 6 and 7 of the last cluster store the hmac (ios only
+         * writes it there), fetch them upfront so never written ranges
+         * are rejected without reading everything */
+        if (nand_read_spare(last_page + 6, spare) < 0)
+            return ISFSVOL_ERROR_READ;
+        memcpy(saved_hmacs[0], &spare[1], 20);
+        memcpy(saved_hmacs[1], &spare[21], 12);
+
+        if (nand_read_spare(last_page + 7, spare) < 0)
+            return ISFSVOL_ERROR_READ;
+        memcpy(&saved_hmacs[1][12], &spare[1], 8);
+
+        if (!memcmp(saved_hmacs[0], blank_hmac, sizeof(blank_hmac)) &&
+            !memcmp(saved_hmacs[1], blank_hmac, sizeof(blank_hmac)))
+            return ISFSVOL_ERROR_HMAC;
+
+        hmac_init(&calc_hmac, ctx->hmac, 20);
+        hmac_update(&calc_hmac, (const u8 *)hmac_seed, SHA_BLOCK_SIZE);
+    }
 
-    /* read all requested clusters */
-    for (i = 0; i < cluster_count; i++)
+    /* read all requested pages, keeping the next page read in flight
+     * while the current one is ecc corrected and decrypted, and hashing
+     * the previous one while the aes engine works on the current one */
+    if (nand_read_page_start(first_page, page_data) < 0)
+        return ISFSVOL_ERROR_READ;
+
+    for (i = 0; i < page_count; i++, page_data += PAGE_SIZE)
     {
-        u32 cluster = start_cluster + i;
-        u8 *cluster_data = (u8 *)data + i * CLUSTER_SIZE;
-        u32 cluster_start = cluster * CLUSTER_PAGES;
+        u8 spare[SPARE_SIZE] = {0};
+        int res;
+
+        p = i % CLUSTER_PAGES;
 
-        /* read cluster pages */
-        for (p = 0; p < CLUSTER_PAGES; p++)
+        /* queue the next page read */
+        if (((i + 1) < page_count) &&
+            (nand_read_page_start(first_page + i + 1, page_data + PAGE_SIZE) < 0))
         {
-            u8 spare[SPARE_SIZE] = {0};
+            nand_read_abort();
+            aes_sync();
+            return ISFSVOL_ERROR_READ;
+        }
 
-            /* attempt to read the page (and correct ecc errors) */
-            rc = nand_read_page(cluster_start + p, &cluster_data[p * PAGE_SIZE], spare);
+        /* finish reading the page (and correct ecc errors) */
+        res = nand_read_page_finish(page_data, spare);
 
-            /* uncorrectable ecc error or other issues */
-            if (rc < 0)
-                return ISFSVOL_ERROR_READ;
+        /* uncorrectable ecc error or other issues */
+        if (res < 0)
+        {
+            nand_read_abort();
+            aes_sync();
+            return ISFSVOL_ERROR_READ;
+        }
 
-            /* ECC errors, a refresh might be needed */
-            if (rc > 0)
-                rc = ISFSVOL_ECC_CORRECTED;
+        /* ECC errors, a refresh might be needed */
+        if (res > 0)
+            rc = ISFSVOL_ECC_CORRECTED;
 
-            /* page 6 and 7 store the hmac */
-            if (p == 6)
-            {
-                memcpy(saved_hmacs[0], &spare[1], 20);
-                memcpy(saved_hmacs[1], &spare[21], 12);
-            }
-            if (p == 7)
-                memcpy(&saved_hmacs[1][12], &spare[1], 8);
+        if (!(flags & ISFSVOL_FLAG_ENCRYPTED))
+        {
+            if (flags & ISFSVOL_FLAG_HMAC)
+                hmac_update(&calc_hmac, page_data, PAGE_SIZE);
+            continue;
         }
 
-        /* decrypt cluster */
-        if (flags & ISFSVOL_FLAG_ENCRYPTED)
+        /* decrypt page in the background, chaining the iv within the cluster */
+        aes_req *req = &reqs[i & 1];
+        req->src = req->dst = page_data;
+        req->blocks = PAGE_SIZE / AES_BLOCK_SIZE;
+        req->decrypt = 1;
+        req->keep_iv = p > 0;
+        req->iv = NULL;
+        req->done = NULL;
+        aes_submit(req);
+
+        /* meanwhile hash the previously decrypted page */
+        if (prev)
         {
-            aes_reset();
-            aes_set_key(ctx->key);
-            aes_empty_iv();
-            aes_decrypt(cluster_data, cluster_data, CLUSTER_SIZE / AES_BLOCK_SIZE, 0);            
+            if (aes_wait(prev) < 0)
+            {
+                nand_read_abort();
+                aes_sync();
+                return ISFSVOL_ERROR_READ;
+            }
+            if (flags & ISFSVOL_FLAG_HMAC)
+                hmac_update(&calc_hmac, prev->dst, PAGE_SIZE);
         }
+        prev = req;
+    }
+
+    /* drain the last decrypted page */
+    if (prev)
+    {
+        if (aes_wait(prev) < 0)
+            return ISFSVOL_ERROR_READ;
+        if (flags & ISFSVOL_FLAG_HMAC)
+            hmac_update(&calc_hmac, prev->dst, PAGE_SIZE);
     }
 
     /* verify hmac */
     if (flags & ISFSVOL_FLAG_HMAC)
     {
-        hmac_ctx calc_hmac;
         int matched = 0;
 
-        /* compute clusters hmac */
-        hmac_init(&calc_hmac, ctx->hmac, 20);
-        hmac_update(&calc_hmac, (const u8 *)hmac_seed, SHA_BLOCK_SIZE);
-        hmac_update(&calc_hmac, (const u8 *)data, cluster_count * CLUSTER_SIZE);
         hmac_final(&calc_hmac, hmac);
 
         /* ensure at least one of the saved hmacs matches */
         matched += !memcmp(saved_hmacs[0], hmac, sizeof(hmac));
         matched += !memcmp(saved_hmacs[1], hmac, sizeof(hmac));
 
+        /* a full match keeps reporting corrected ecc errors */
         if (matched == 2)
-            rc = ISFSVOL_OK;
+            rc = (rc == ISFSVOL_ECC_CORRECTED) ? rc : ISFSVOL_OK;
         else if (matched == 1)
             rc = ISFSVOL_HMAC_PARTIAL;
         else
@@ -154,17 +247,16 @@ int isfs_read_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count,
     return rc;
 }
 
-int isfs_write_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count, u32 flags, void *hmac_seed, void *data)
+static int isfs_do_write_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count, u32 flags, void *hmac_seed, void *data)
 {
     static u8 blockpg[64][PAGE_SIZE] ALIGNED(64), blocksp[64][SPARE_SIZE];
-    static u8 pgbuf[PAGE_SIZE] ALIGNED(64), spbuf[SPARE_SIZE];
+    static u8 rbpg[CLUSTER_PAGES][PAGE_SIZE] ALIGNED(64), rbsp[CLUSTER_PAGES][SPARE_SIZE];
+    static aes_req reqs[BLOCK_PAGES];
+    static u8 *blockdata[BLOCK_PAGES];
     u8 hmac[20] = {0};
     int rc = ISFSVOL_OK;
     u32 b, p;
 
-    /* enable slc or slccmpt bank */
-    nand_enable_banks(ctx->bank);
-
     /* compute clusters hmac */
     if (flags & ISFSVOL_FLAG_HMAC)
     {
@@ -189,24 +281,60 @@ int isfs_write_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count,
     u32 startblock = start_cluster / BLOCK_CLUSTERS;
     u32 endblock = (start_cluster + cluster_count + BLOCK_CLUSTERS - 1) / BLOCK_CLUSTERS;
 
+    /* plaintext aligned data can be programmed without staging it */
+    bool direct = !(flags & ISFSVOL_FLAG_ENCRYPTED) && !((u32)data & 0x1f);
+
     /* process data in nand blocks */
     for (b = startblock; (b < endblock) && (rc >= 0); b++)
     {
         u32 firstblockpage = b * BLOCK_PAGES;
+        u64 skip = 0;
+
+        /* read the pages to preserve, keeping the next read in flight */
+        int prev = -1;
+        for (p = 0; p <= BLOCK_PAGES; p++)
+        {
+            u32 curpage = firstblockpage + p;
+            bool keep = (p < BLOCK_PAGES) && ((curpage < startpage) || (curpage >= endpage));
+
+            if (keep && (nand_read_page_start(curpage, blockpg[p]) < 0))
+                rc = ISFSVOL_ERROR_READ;
+
+            if ((prev >= 0) && (rc >= 0) &&
+                (nand_read_page_finish(blockpg[prev], blocksp[prev]) < 0))
+                rc = ISFSVOL_ERROR_READ;
+
+            if (rc < 0)
+            {
+                nand_read_abort();
+                aes_sync();
+                return rc;
+            }
+
+            /* erased pages are left alone, the erase restores them */
+            if (prev >= 0)
+            {
+                u32 i;
+                for (i = 0; (i < PAGE_SIZE) && (blockpg[prev][i] == 0xff); i++);
+                if (i == PAGE_SIZE)
+                    for (i = 0; (i < SPARE_SIZE) && (blocksp[prev][i] == 0xff); i++);
+                if (i == SPARE_SIZE)
+                    skip |= 1ULL << prev;
+            }
+
+            prev = keep ? (int)p : -1;
+            if (keep)
+                blockdata[p] = blockpg[p];
+        }
 
-        /* prepare block */
-        for (p = 0; p < 64; p++)
+        /* prepare the new pages */
+        for (p = 0; p < BLOCK_PAGES; p++)
         {
             u32 curpage = firstblockpage + p;       /* current page */
             u32 clusidx = curpage % CLUSTER_PAGES;  /* index in cluster */
 
-            /* if this page is unmodified, read it from nand */
             if ((curpage < startpage) || (curpage >= endpage))
-            {
-                if (nand_read_page(curpage, blockpg[p], blocksp[p]) < 0)
-                    return ISFSVOL_ERROR_READ;
                 continue;
-            }
 
             /* place hmac in page 6 and 7 of a cluster */
             memset(blocksp[p], 0, SPARE_SIZE);
@@ -221,39 +349,113 @@ int isfs_write_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count,
                 break;
             }
 
-            /* encrypt or copy the data */
+            /* encrypt (in the background) or program the data in place */
             u8 *srcdata = (u8*)data + (curpage - startpage) * PAGE_SIZE;
             if (flags & ISFSVOL_FLAG_ENCRYPTED)
-                aes_encrypt(blockpg[p], srcdata, PAGE_SIZE / AES_BLOCK_SIZE, clusidx > 0);
+            {
+                aes_req *req = &reqs[p];
+                req->src = srcdata;
+                req->dst = blockpg[p];
+                req->blocks = PAGE_SIZE / AES_BLOCK_SIZE;
+                req->decrypt = 0;
+                req->keep_iv = clusidx > 0;
+                req->iv = NULL;
+                req->done = NULL;
+                aes_submit(req);
+                blockdata[p] = blockpg[p];
+            }
+            else if (direct)
+                blockdata[p] = srcdata;
             else
+            {
                 memcpy(blockpg[p], srcdata, PAGE_SIZE);
+                blockdata[p] = blockpg[p];
+            }
         }
 
-        /* erase block */
+        /* erase block while the pages are being encrypted */
         if (nand_erase_block(b) < 0)
+        {
+            aes_sync();
             return ISFSVOL_ERROR_ERASE;
+        }
 
-        /* write block */
+        /* wait for the encrypted pages */
         for (p = 0; p < BLOCK_PAGES; p++)
-            if (nand_write_page(firstblockpage + p, blockpg[p], blocksp[p]) < 0)
+        {
+            u32 curpage = firstblockpage + p;
+            if ((flags & ISFSVOL_FLAG_ENCRYPTED) &&
+                (curpage >= startpage) && (curpage < endpage) &&
+                (aes_wait(&reqs[p]) < 0))
                 rc = ISFSVOL_ERROR_WRITE;
+        }
+        if (rc < 0)
+            break;
+
+        /* write block, programming runs of contiguous pages together */
+        for (p = 0; (p < BLOCK_PAGES) && (rc >= 0); p++)
+        {
+            u32 n = 1;
+
+            if (skip & (1ULL << p))
+                continue;
+
+            while (((p + n) < BLOCK_PAGES) && !(skip & (1ULL << (p + n))) &&
+                   (blockdata[p + n] == blockdata[p] + n * PAGE_SIZE))
+                n++;
+
+            if (nand_write_pages(firstblockpage + p, n, blockdata[p], blocksp[p]) < 0)
+                rc = ISFSVOL_ERROR_WRITE;
+            p += n - 1;
+        }
 
         /* check if pages should be verified after writing */
         if (rc || !(flags & ISFSVOL_FLAG_READBACK))
             continue;
 
-        /* read back pages */
-        for (p = 0; p < BLOCK_PAGES; p++)
+        /* read back pages a cluster at a time */
+        for (p = 0; p < BLOCK_PAGES; p += CLUSTER_PAGES)
         {
-            if (nand_read_page(firstblockpage + p, pgbuf, spbuf) < 0)
+            u32 i;
+
+            if (nand_read_pages(firstblockpage + p, CLUSTER_PAGES, rbpg, rbsp) < 0)
                 return ISFSVOL_ERROR_READ;
 
-            /* page content doesn't match */
-            if (memcmp(blockpg[p], pgbuf, PAGE_SIZE) ||
-                memcmp(&blocksp[p][1], &spbuf[1], 0x20))
-                return ISFSVOL_ERROR_READBACK;
+            for (i = 0; i < CLUSTER_PAGES; i++)
+            {
+                if (skip & (1ULL << (p + i)))
+                    continue;
+
+                /* page content doesn't match */
+                if (memcmp(blockdata[p + i], rbpg[i], PAGE_SIZE) ||
+                    memcmp(&blocksp[p + i][1], &rbsp[i][1], 0x20))
+                    return ISFSVOL_ERROR_READBACK;
+            }
         }
     }
 
     return rc;
 }
+
+int isfs_read_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count, u32 flags, void *hmac_seed, void *data)
+{
+    /* enable slc or slccmpt bank */
+    int rc = ISFSVOL_ERROR_READ;
+    if (nand_batch_begin(ctx->bank, 0) >= 0)
+        rc = isfs_do_read_volume(ctx, start_cluster, cluster_count, flags, hmac_seed, data);
+    nand_batch_end();
+    return rc;
+}
+
+int isfs_write_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count, u32 flags, void *hmac_seed, void *data)
+{
+    /* enable slc or slccmpt bank, writable for the whole operation */
+    int rc = ISFSVOL_ERROR_WRITE;
+    if (nand_batch_begin(ctx->bank, 1) >= 0)
+        rc = isfs_do_write_volume(ctx, start_cluster, cluster_count, flags, hmac_seed, data);
+    nand_batch_end();
+
+    /* cached copies are stale even if the write failed halfway */
+    isfs_cache_invalidate(ctx, start_cluster, cluster_count);
+    return rc;
+}
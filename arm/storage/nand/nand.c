@@ -14,18 +14,21 @@
  */
 
 #include "nand.h"
+#include "image.h"
+#include "ecc.h"
 #include "common/utils.h"
 #include "common/types.h"
 #include "system/latte.h"
 #include "system/memory.h"
 #include "system/irq.h"
 #include "crypto/crypto.h"
+#include "nand_stats.h"
 #include <string.h>
 #include <stdio.h>
 
 /* ECC definitions */
-#define ECC_SIZE            0x10
-#define ECC_STOR_OFFS       0x30
+#define ECC_SIZE            ECC_PAGE_SIZE
+#define ECC_STOR_OFFS       ECC_SPARE_OFFS
 #define ECC_CALC_OFFS       0x40
 
 /* required buffers size */
@@ -42,8 +45,11 @@
 #define CMD_SERIALDATA_IN   0x80
 #define CMD_RANDOMDATA_IN   0x85
 #define CMD_PROGRAM         0x10
+#define CMD_CACHE_PROGRAM   0x15
 #define CMD_READ_SETUP      0x00
 #define CMD_READ            0x30
+#define CMD_CACHE_READ      0x31
+#define CMD_CACHE_READ_END  0x3f
 
 /* NAND_CTRL definitions */
 #define CTRL_FL_EXEC        (0x80000000)
@@ -63,6 +69,14 @@
 #define CONF_ATTR_INIT      (0x743e3eff) /* initial nand config */
 #define CONF_ATTR_NORMAL    (0x550f1eff) /* normal nand config */
 
+/* command classes for completion statistics */
+#define NAND_OP_READ            0
+#define NAND_OP_CACHE_READ      1
+#define NAND_OP_PROGRAM         2
+#define NAND_OP_CACHE_PROGRAM   3
+#define NAND_OP_ERASE           4
+#define NAND_OP_COUNT           5
+
 /* NAND_BANK definitions */
 #define BANK_FL_4           (0x00000004) /* set by bsp:fla for revisions after latte A2X */
 
@@ -71,21 +85,122 @@ static u8 nand_status_buf[STATUS_BUF_SIZE] ALIGNED(256);
 #endif
 static u8 nand_spare_buf[SPARE_BUF_SIZE] ALIGNED(256);
 
+/* pipelined page reads: one read on the bus, one waiting to be finished */
+#define NAND_READ_SLOTS     2
+static u8 nand_read_spare_buf[NAND_READ_SLOTS][0x100] ALIGNED(256);
+static void *nand_read_data[NAND_READ_SLOTS];
+static int nand_read_status[NAND_READ_SLOTS];
+static u32 nand_read_time[NAND_READ_SLOTS];
+static u32 nand_reads_issued = 0, nand_reads_finished = 0;
+static int nand_read_busy = 0;
+
 static u32 nand_enabled_banks = BANK_SLC;
 
-static int irq_flag = 0;
+/* configuration last written to the controller, ~0 when unknown */
+static u32 nand_cur_conf = ~0, nand_cur_bank = ~0;
+
+/* nested batches of operations on a single bank */
+static u32 nand_batch_depth = 0;
+static int nand_batch_write = 0;
+static u32 nand_batch_prev_bank = BANK_SLC;
+
+static volatile int irq_flag = 0;
+
+/* completion of the last command: spin for up to NAND_SPIN_MAX_TICKS, then
+ * sleep until IRQ_NAND; a running average of the latency of each command
+ * class, fed whenever the end of a command is seen, skips the spin for
+ * slow commands */
+#define NAND_US2TICKS(x)        ((x) * 1898 / 1000)
+#define NAND_SPIN_MAX_TICKS     NAND_US2TICKS(100)
+
+static u32 nand_op_avg[NAND_OP_COUNT] = {
+    [NAND_OP_READ]          = NAND_US2TICKS(25),
+    [NAND_OP_CACHE_READ]    = NAND_US2TICKS(25),
+    [NAND_OP_PROGRAM]       = NAND_US2TICKS(200),
+    [NAND_OP_CACHE_PROGRAM] = NAND_US2TICKS(200),
+    [NAND_OP_ERASE]         = NAND_US2TICKS(2000),
+};
+static u32 nand_op_start_time = 0;
+
+static void nand_read_complete(void);
+
+/* background raw page reads, chained by the nand irq handler */
+static struct {
+    u8 *buf;
+    u32 pageno;
+    u32 count;
+    volatile u32 done;
+    volatile int active;
+    volatile int error;
+} nand_bg = { 0 };
+
+static void nand_bg_issue(void)
+{
+    u8 *buf = nand_bg.buf + nand_bg.done * (PAGE_SIZE + SPARE_SIZE);
+
+    write32(NAND_CTRL, 0);
+    write32(NAND_ADDR0, 0);
+    write32(NAND_ADDR1, nand_bg.pageno + nand_bg.done);
+    write32(NAND_CTRL,
+        CTRL_FL_EXEC |
+        CTRL_ADDR(0x1f) |
+        CTRL_CMD(CMD_READ_SETUP));
+    while(read32(NAND_CTRL) & CTRL_FL_EXEC);
+
+    /* without ecc the spare directly follows the page data */
+    write32(NAND_CTRL, 0);
+    write32(NAND_DATA, dma_addr(buf));
+    write32(NAND_ECC, 0);
+    write32(NAND_CTRL,
+        CTRL_FL_EXEC |
+        CTRL_FL_IRQ |
+        CTRL_CMD(CMD_READ) |
+        CTRL_FL_WAIT |
+        CTRL_FL_RD |
+        CTRL_SIZE(PAGE_SIZE + SPARE_SIZE));
+}
 
 int nand_error(const char *error)
 {
     printf("nand: %s\n", error);
+
+    /* resetting the controller aborts the page read in flight */
+    if (nand_read_busy) {
+        nand_read_status[(nand_reads_issued - 1) % NAND_READ_SLOTS] = -1;
+        nand_read_busy = 0;
+    }
+
+#if NAND_IMAGE_ENABLED
+    /* image errors come from the sd card, leave the real controller alone */
+    if (nand_image_attached())
+        return -1;
+#endif
+
     nand_initialize();
     return -1;
 }
 
 void nand_irq(void)
 {
+    /* stale interrupt of a command that was already polled to completion */
+    if (read32(NAND_CTRL) & CTRL_FL_EXEC) {
+        return;
+    }
+
     ahb_flush_from(WB_FLA);
     ahb_flush_to(RB_IOD);
+
+    /* chain the next background read straight from the interrupt */
+    if (nand_bg.active) {
+        if (read32(NAND_CTRL) & CTRL_FL_ERR) {
+            nand_bg.error = -1;
+        } else if (++nand_bg.done < nand_bg.count) {
+            nand_bg_issue();
+            return;
+        }
+        nand_bg.active = 0;
+    }
+
     irq_flag = 1;
 }
 
@@ -106,9 +221,52 @@ void nand_wait_irq(void)
     }
 }
 
-void nand_enable_banks(u32 bank)
+static u32 nand_op_begin(int op)
+{
+    (void)op;
+
+    /* every command raises IRQ_NAND, the waiter decides whether to sleep */
+    nand_irq_clear_and_enable();
+    nand_op_start_time = read32(LT_TIMER);
+    return CTRL_FL_IRQ;
+}
+
+static void nand_op_wait(int op)
+{
+    u32 spin_start = read32(LT_TIMER);
+    /* commands that usually outlast the budget go straight to sleep */
+    u32 budget = (nand_op_avg[op] > 2 * NAND_SPIN_MAX_TICKS) ? 0 : NAND_SPIN_MAX_TICKS;
+
+    /* pipelined reads may finish during the overlapped work, which
+     * doesn't tell how long the command itself took */
+    if (read32(NAND_CTRL) & CTRL_FL_EXEC) {
+        while((read32(NAND_CTRL) & CTRL_FL_EXEC) &&
+              (read32(LT_TIMER) - spin_start) < budget);
+
+        if (read32(NAND_CTRL) & CTRL_FL_EXEC) {
+            nand_wait_irq();
+            /* a late interrupt from the previous command can wake us early */
+            while(read32(NAND_CTRL) & CTRL_FL_EXEC);
+        }
+
+        u32 elapsed = read32(LT_TIMER) - nand_op_start_time;
+        nand_op_avg[op] = nand_op_avg[op] - (nand_op_avg[op] >> 3) + (elapsed >> 3);
+    }
+
+    ahb_flush_from(WB_FLA);
+    ahb_flush_to(RB_IOD);
+}
+
+int nand_enable_banks(u32 bank)
 {
+    /* the batch owns the bank until it ends */
+    if (nand_batch_depth && ((bank & 3) != nand_enabled_banks)) {
+        printf("nand: bank switch inside a batch\n");
+        return -1;
+    }
+
     nand_enabled_banks = bank & 3;
+    return 0;
 }
 
 void nand_set_config(int write_enable)
@@ -116,28 +274,120 @@ void nand_set_config(int write_enable)
     u32 conf, bank;
 
     write32(NAND_CTRL, 0);
-    write32(NAND_CONF, 0);
+
+    /* a batch allowing writes keeps write protection off throughout */
+    write_enable |= nand_batch_write;
 
     /* set nand config */
     conf = (write_enable ? 0 : CONF_FL_WP)
          | (CONF_FL_EN)
          | (CONF_ATTR_NORMAL);
-    write32(NAND_CONF, conf);
 
     /* set nand bank */
     bank = BANK_FL_4
          | nand_enabled_banks; 
+
+    /* the controller keeps its configuration between commands */
+    if ((conf == nand_cur_conf) && (bank == nand_cur_bank)) {
+        return;
+    }
+
+    write32(NAND_CONF, 0);
+    write32(NAND_CONF, conf);
     write32(NAND_BANK, bank);
+
+    nand_cur_conf = conf;
+    nand_cur_bank = bank;
+}
+
+int nand_batch_begin(u32 bank, int write_enable)
+{
+    if (nand_batch_depth++ == 0) {
+        nand_batch_prev_bank = nand_enabled_banks;
+        nand_enable_banks(bank);
+        nand_batch_write = write_enable ? 1 : 0;
+        return 0;
+    }
+
+    /* nested batches run inside the outer one, they can't widen it */
+    if ((bank & 3) != nand_enabled_banks) {
+        printf("nand: nested batch on bank %lu inside a batch on bank %lu\n", bank & 3, nand_enabled_banks);
+        return -1;
+    }
+    if (write_enable && !nand_batch_write) {
+        printf("nand: nested write batch inside a read only batch\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void nand_batch_end(void)
+{
+    if (!nand_batch_depth || --nand_batch_depth) {
+        return;
+    }
+
+    /* restore write protection */
+    nand_read_complete();
+    if (nand_batch_write) {
+        nand_batch_write = 0;
+        nand_set_config(0);
+    }
+
+    /* and the bank selected before the batch */
+    nand_enable_banks(nand_batch_prev_bank);
 }
 
 #if NAND_WRITE_ENABLED
 
-int nand_erase_block(u32 blockno)
+static void nand_prepare_spare(const void *spare)
+{
+    if (spare) {
+        memcpy(nand_spare_buf, spare, SPARE_SIZE);
+    } else {
+        memset(nand_spare_buf, 0, SPARE_SIZE);
+    }
+    nand_spare_buf[0] = 0xff;
+    memcpy(nand_spare_buf + ECC_STOR_OFFS, nand_spare_buf + ECC_CALC_OFFS, ECC_SIZE);
+}
+
+static u8 nand_get_status(void)
+{
+    *nand_status_buf = 1;
+    dc_flushrange(nand_status_buf, STATUS_BUF_SIZE);
+
+    write32(NAND_DATA, dma_addr(nand_status_buf));
+    write32(NAND_CTRL,
+            CTRL_FL_EXEC |
+            CTRL_CMD(CMD_GET_STATUS) |
+            CTRL_FL_RD |
+            CTRL_SIZE(STATUS_BUF_SIZE));
+    while(read32(NAND_CTRL) & CTRL_FL_EXEC);
+
+    ahb_flush_from(WB_FLA);
+    dc_invalidaterange(nand_status_buf, STATUS_BUF_SIZE);
+
+    return *nand_status_buf;
+}
+
+static int nand_do_erase_block(u32 blockno)
 {
+    /* wait for pipelined page reads to leave the bus */
+    nand_read_complete();
+
     if (blockno > BLOCK_COUNT) {
         return nand_error("invalid block number");
     }
 
+#if NAND_IMAGE_ENABLED
+    if (nand_image_attached()) {
+        if (nand_image_erase_block(nand_enabled_banks, blockno) < 0)
+            return nand_error("erase command failed");
+        return 0;
+    }
+#endif
+
     /* clear write protection */
     nand_set_config(1);
 
@@ -152,59 +402,45 @@ int nand_erase_block(u32 blockno)
     while(read32(NAND_CTRL) & CTRL_FL_EXEC);
 
     write32(NAND_CTRL, 0);
-    nand_irq_clear_and_enable();
 
     /* erase */
     write32(NAND_CTRL,
         CTRL_FL_EXEC |
-        CTRL_FL_IRQ |
+        nand_op_begin(NAND_OP_ERASE) |
         CTRL_CMD(CMD_ERASE) |
         CTRL_FL_WAIT);
-    nand_wait_irq();
+    nand_op_wait(NAND_OP_ERASE);
 
     /* set write protection */
     nand_set_config(0);
 
-    /* get status */
-    *nand_status_buf = 1;
-    dc_flushrange(nand_status_buf, STATUS_BUF_SIZE);
-
-    write32(NAND_DATA, dma_addr(nand_status_buf));
-    write32(NAND_CTRL,
-        CTRL_FL_EXEC |
-        CTRL_CMD(CMD_GET_STATUS) |
-        CTRL_FL_RD |
-        CTRL_SIZE(STATUS_BUF_SIZE));
-
-    while(read32(NAND_CTRL) & CTRL_FL_EXEC);
-
-    ahb_flush_from(WB_FLA);
-    dc_invalidaterange(nand_status_buf, STATUS_BUF_SIZE);
-
     /* check failure */
-    if (*nand_status_buf & 1) {
+    if (nand_get_status() & 1) {
         return nand_error("erase command failed");
     }
 
     return 0;
 }
 
-int nand_write_page(u32 pageno, void *data, void *spare)
+int nand_erase_block(u32 blockno)
 {
-    if (pageno > PAGE_COUNT) {
-        return nand_error("invalid page number");
-    }
-    if ((u32)data & 0x1f) {
-        return nand_error("unaligned page buffer");
-    }
+    u32 start = nand_stats_now();
+    int rc = nand_do_erase_block(blockno);
+
+    nand_stats_op(nand_enabled_banks, NAND_STAT_ERASE, start);
+    if (rc < 0)
+        nand_stats_event(nand_enabled_banks, NAND_EV_ERASE_FAIL);
+
+    return rc;
+}
 
+/* load page content and spare into the chip cache register */
+static int nand_send_page(u32 pageno, void *data, void *spare)
+{
     dc_flushrange(data, PAGE_SIZE);
     ahb_flush_to(RB_FLA);
     dc_invalidaterange(nand_spare_buf + ECC_CALC_OFFS, ECC_SIZE);
 
-    /* clear write protection */
-    nand_set_config(1);
-
     /* send page content and calc ecc */
     write32(NAND_CTRL, 0);
     write32(NAND_ADDR0, 0);
@@ -221,25 +457,16 @@ int nand_write_page(u32 pageno, void *data, void *spare)
     while(read32(NAND_CTRL) & CTRL_FL_EXEC);
 
     if (read32(NAND_CTRL) & CTRL_FL_ERR) {
-        nand_error("error executing data input command");
+        return nand_error("error executing data input command");
     }
 
     /* prepare page spare */
     ahb_flush_from(WB_FLA);
-    if (spare) {
-        memcpy(nand_spare_buf, spare, SPARE_SIZE);
-    } else {
-        memset(nand_spare_buf, 0, SPARE_SIZE);
-    }
-    nand_spare_buf[0] = 0xff;
-    memcpy(nand_spare_buf + ECC_STOR_OFFS, nand_spare_buf + ECC_CALC_OFFS, ECC_SIZE);
+    nand_prepare_spare(spare);
     dc_flushrange(nand_spare_buf, SPARE_SIZE);
 
-    /* setup irq */
-    write32(NAND_CTRL, 0);
-    nand_irq_clear_and_enable();
-
     /* send spare content */
+    write32(NAND_CTRL, 0);
     write32(NAND_ADDR0, PAGE_SIZE);
     write32(NAND_ADDR1, 0);
     write32(NAND_DATA, dma_addr(nand_spare_buf));
@@ -253,93 +480,149 @@ int nand_write_page(u32 pageno, void *data, void *spare)
     while(read32(NAND_CTRL) & CTRL_FL_EXEC);
 
     if (read32(NAND_CTRL) & CTRL_FL_ERR) {
-        nand_error("error executing random data input command");
+        return nand_error("error executing random data input command");
     }
 
-    /* program page */
-    write32(NAND_CTRL, 0);
-    write32(NAND_CTRL,
-        CTRL_FL_EXEC |
-        CTRL_FL_IRQ |
-        CTRL_CMD(CMD_PROGRAM) |
-        CTRL_FL_WAIT);
-    nand_wait_irq();
+    return 0;
+}
 
-    /* set write protection */
-    nand_set_config(0);
+int nand_write_pages(u32 pageno, u32 count, void *data, void *spare)
+{
+    u8 *page = (u8 *)data, *page_spare = (u8 *)spare;
+    u32 i;
 
-    /* get status */
-    *nand_status_buf = 1;
-    dc_flushrange(nand_status_buf, STATUS_BUF_SIZE);
-    
-    write32(NAND_DATA, dma_addr(nand_status_buf));
-    write32(NAND_CTRL,
+    /* wait for pipelined page reads to leave the bus */
+    nand_read_complete();
+
+    if ((pageno + count) > PAGE_COUNT) {
+        return nand_error("invalid page number");
+    }
+    if ((u32)data & 0x1f) {
+        return nand_error("unaligned page buffer");
+    }
+
+#if NAND_IMAGE_ENABLED
+    if (nand_image_attached()) {
+        for (i = 0; i < count; i++, page += PAGE_SIZE) {
+            u32 start = nand_stats_now();
+            nand_ecc_calc(page, nand_spare_buf + ECC_CALC_OFFS);
+            nand_prepare_spare(page_spare ? page_spare + i * SPARE_SIZE : NULL);
+            if (nand_image_write_page(nand_enabled_banks, pageno + i, page, nand_spare_buf) < 0) {
+                nand_stats_event(nand_enabled_banks, NAND_EV_PROGRAM_FAIL);
+                return nand_error("page program command failed");
+            }
+            nand_stats_op(nand_enabled_banks, NAND_STAT_PROGRAM, start);
+        }
+        return 0;
+    }
+#endif
+
+    /* clear write protection */
+    nand_set_config(1);
+
+    for (i = 0; i < count; i++, page += PAGE_SIZE) {
+        bool last = (i + 1) == count;
+        u32 start = nand_stats_now();
+
+        if (nand_send_page(pageno + i, page, page_spare ? page_spare + i * SPARE_SIZE : NULL) < 0) {
+            return -1;
+        }
+
+        /* cache program returns as soon as the cache register is free,
+         * so the next page is transferred while this one is programmed */
+        write32(NAND_CTRL, 0);
+        write32(NAND_CTRL,
             CTRL_FL_EXEC |
-            CTRL_CMD(CMD_GET_STATUS) |
-            CTRL_FL_RD |
-            CTRL_SIZE(STATUS_BUF_SIZE));
-    while(read32(NAND_CTRL) & CTRL_FL_EXEC);
+            nand_op_begin(last ? NAND_OP_PROGRAM : NAND_OP_CACHE_PROGRAM) |
+            CTRL_CMD(last ? CMD_PROGRAM : CMD_CACHE_PROGRAM) |
+            CTRL_FL_WAIT);
+        nand_op_wait(last ? NAND_OP_PROGRAM : NAND_OP_CACHE_PROGRAM);
+        nand_stats_op(nand_enabled_banks, NAND_STAT_PROGRAM, start);
+
+        /* bit 1 reports the previous page of a cache program sequence */
+        if ((i > 0) && (nand_get_status() & 2)) {
+            nand_stats_event(nand_enabled_banks, NAND_EV_PROGRAM_FAIL);
+            nand_set_config(0);
+            return nand_error("page program command failed");
+        }
+    }
 
-    ahb_flush_from(WB_FLA);
-    dc_invalidaterange(nand_status_buf, STATUS_BUF_SIZE);
+    /* set write protection */
+    nand_set_config(0);
 
     /* check failure */
-    if (*nand_status_buf & 1) {
+    if (nand_get_status() & 1) {
+        nand_stats_event(nand_enabled_banks, NAND_EV_PROGRAM_FAIL);
         return nand_error("page program command failed");
     }
-    
+
     return 0;
 }
 
+int nand_write_page(u32 pageno, void *data, void *spare)
+{
+    return nand_write_pages(pageno, 1, data, spare);
+}
+
 #endif
 
-int nand_ecc_correct(u8 *data, u32 *ecc_save, u32 *ecc_calc, u32 size)
+/* check and correct a page read, accounting the result */
+static int nand_ecc_check(u8 *data, u8 *spare_buf)
 {
-    u32 syndrome;
+    u32 start = nand_stats_now();
+    s8 bits[ECC_SUBPAGES];
+    int res = nand_ecc_correct(data,
+                               spare_buf + ECC_STOR_OFFS,
+                               spare_buf + ECC_CALC_OFFS,
+                               bits);
+
+    nand_stats_op(nand_enabled_banks, NAND_STAT_ECC, start);
+    if (res < 0) {
+        nand_stats_event(nand_enabled_banks, NAND_EV_ECC_UNCORRECTABLE);
+        return -1;
+    }
 
-    /* check if the page contain ecc errors */
-    if (!memcmp(ecc_save, ecc_calc, size)) {
-        return 0;
+    if (res > 0) {
+        nand_stats_add(nand_enabled_banks, NAND_EV_ECC_BITS, res);
+        nand_stats_ecc(nand_enabled_banks, bits);
+        nand_stats_event(nand_enabled_banks, NAND_EV_ECC_CORRECTED);
+        return 1;
     }
 
-    /* correct ecc errors */
-    for (int i = 0; i < (size / 4); i++) {
-        if (ecc_save[i] == ecc_calc[i]) {
-            continue;
-        }
+    return 0;
+}
 
-        /* don't try to correct unformatted pages */
-        if (ecc_save[i] == 0xffffffff) {
-            continue;
-        }
+static void nand_read_complete(void)
+{
+    u32 slot;
 
-        /* calculate ecc syndrome */
-        syndrome = (ecc_save[i] ^ ecc_calc[i]); // & 0x0fff0fff;
-        if ((syndrome & (syndrome - 1)) == 0) {
-            continue;
-        }
+    /* background reads own the controller until they are done */
+    if (nand_bg.active)
+        nand_bg_read_wait();
 
-        /* extract odd and even halves */
-        //odd = syndrome >> 16;
-        //even = syndrome;
-        u16 even = (syndrome >> 24) | ((syndrome >> 8) & 0xf00);
-        u16 odd = ((syndrome << 8) & 0xf00) | ((syndrome >> 8) & 0x0ff);
+    if (!nand_read_busy)
+        return;
 
-        /* uncorrectable error */
-        if ((odd ^ even) != 0xfff) {
-            return -1;
-        }
+    /* wait for the page read in flight */
+    slot = (nand_reads_issued - 1) % NAND_READ_SLOTS;
+    nand_op_wait(NAND_OP_READ);
+    nand_read_busy = 0;
+    nand_stats_op(nand_enabled_banks, NAND_STAT_READ, nand_read_time[slot]);
 
-        /* fix the bad bit */
-        data[i * 0x200 + (odd >> 3)] ^= 1 << (odd & 7);
+    if (read32(NAND_CTRL) & CTRL_FL_ERR) {
+        nand_read_status[slot] = -1;
+        nand_error("error executing page read command");
+        return;
     }
 
-    return 1;
+    write32(NAND_CTRL, 0);
+    ahb_flush_from(WB_FLA);
 }
 
-int nand_read_page(u32 pageno, void *data, void *spare)
+int nand_read_page_start(u32 pageno, void *data)
 {
-    int res = 0;
+    u32 slot;
+    u8 *spare_buf;
 
     if (pageno > PAGE_COUNT) {
         return nand_error("invalid page number");
@@ -347,6 +630,30 @@ int nand_read_page(u32 pageno, void *data, void *spare)
     if ((u32)data & 0x1f) {
         return nand_error("unaligned page buffer");
     }
+    if ((nand_reads_issued - nand_reads_finished) >= NAND_READ_SLOTS) {
+        return nand_error("too many page reads pending");
+    }
+
+    /* the previous read must be off the bus before issuing the next one */
+    nand_read_complete();
+
+    slot = nand_reads_issued % NAND_READ_SLOTS;
+    spare_buf = nand_read_spare_buf[slot];
+    nand_read_data[slot] = data;
+    nand_read_status[slot] = 0;
+    nand_read_time[slot] = nand_stats_now();
+    nand_reads_issued++;
+
+#if NAND_IMAGE_ENABLED
+    if (nand_image_attached()) {
+        if (nand_image_read_page(nand_enabled_banks, pageno, data, spare_buf) < 0)
+            nand_read_status[slot] = -1;
+        else
+            nand_ecc_calc(data, spare_buf + ECC_CALC_OFFS);
+        nand_stats_op(nand_enabled_banks, NAND_STAT_READ, nand_read_time[slot]);
+        return 0;
+    }
+#endif
 
     /* set nand config */
     nand_set_config(0);
@@ -361,42 +668,371 @@ int nand_read_page(u32 pageno, void *data, void *spare)
         CTRL_CMD(CMD_READ_SETUP));
     while(read32(NAND_CTRL) & CTRL_FL_EXEC);
 
-    /* read page and spare */
+    /* read page and spare, completion is signaled through IRQ_NAND */
     dc_invalidaterange(data, PAGE_SIZE);
-    dc_invalidaterange(nand_spare_buf, SPARE_BUF_SIZE);
+    dc_invalidaterange(spare_buf, SPARE_BUF_SIZE);
     write32(NAND_CTRL, 0);
     write32(NAND_DATA, dma_addr(data));
-    write32(NAND_ECC, dma_addr(nand_spare_buf));
-    nand_irq_clear_and_enable();
+    write32(NAND_ECC, dma_addr(spare_buf));
+    nand_read_busy = 1;
     write32(NAND_CTRL,
         CTRL_FL_EXEC |
-        CTRL_FL_IRQ |
+        nand_op_begin(NAND_OP_READ) |
         CTRL_CMD(CMD_READ) |
         CTRL_FL_WAIT |
         CTRL_FL_RD |
         CTRL_FL_ECC |
         CTRL_SIZE(PAGE_SIZE + SPARE_SIZE));
-    nand_wait_irq();
 
-    if (read32(NAND_CTRL) & CTRL_FL_ERR) {
-        return nand_error("error executing page read command");
+    return 0;
+}
+
+int nand_read_page_finish(void *data, void *spare)
+{
+    u32 slot;
+    u8 *spare_buf;
+    int res = 0;
+
+    if (nand_reads_issued == nand_reads_finished) {
+        return nand_error("no page read pending");
     }
 
-    write32(NAND_CTRL, 0);
-    ahb_flush_from(WB_FLA);
+    slot = nand_reads_finished % NAND_READ_SLOTS;
+    spare_buf = nand_read_spare_buf[slot];
+
+    /* only wait if this is the read still in flight */
+    if ((nand_reads_finished + 1) == nand_reads_issued) {
+        nand_read_complete();
+    }
+    nand_reads_finished++;
+
+    if (nand_read_status[slot] < 0) {
+        return -1;
+    }
+    if (nand_read_data[slot] != data) {
+        return nand_error("page reads finished out of order");
+    }
 
     /* correct ecc errors */
-    res = nand_ecc_correct(data,
-                           (u32*)(nand_spare_buf + ECC_STOR_OFFS),
-                           (u32*)(nand_spare_buf + ECC_CALC_OFFS),
-                           ECC_SIZE);
+    res = nand_ecc_check(data, spare_buf);
     if (res < 0) {
+        /* don't let the controller reset abort the next page read */
+        nand_read_complete();
         return nand_error("uncorrectable ecc error");
     }
 
     /* copy spare from internal buffer */
     if (spare) {
-        memcpy(spare, nand_spare_buf, SPARE_SIZE);
+        memcpy(spare, spare_buf, SPARE_SIZE);
+    }
+
+    return res;
+}
+
+void nand_read_abort(void)
+{
+    nand_read_complete();
+    nand_reads_finished = nand_reads_issued;
+}
+
+int nand_read_page(u32 pageno, void *data, void *spare)
+{
+    if (nand_read_page_start(pageno, data) < 0) {
+        return -1;
+    }
+
+    return nand_read_page_finish(data, spare);
+}
+
+static int nand_do_read_spare(u32 pageno, void *spare)
+{
+    /* wait for pipelined page reads to leave the bus */
+    nand_read_complete();
+
+    if (pageno > PAGE_COUNT) {
+        return nand_error("invalid page number");
+    }
+
+#if NAND_IMAGE_ENABLED
+    if (nand_image_attached()) {
+        if (nand_image_read_spare(nand_enabled_banks, pageno, spare) < 0)
+            return nand_error("error executing spare read command");
+        return 0;
+    }
+#endif
+
+    /* set nand config */
+    nand_set_config(0);
+
+    /* start reading at the spare column */
+    write32(NAND_CTRL, 0);
+    write32(NAND_ADDR0, PAGE_SIZE);
+    write32(NAND_ADDR1, pageno);
+    write32(NAND_CTRL,
+        CTRL_FL_EXEC |
+        CTRL_ADDR(0x1f) |
+        CTRL_CMD(CMD_READ_SETUP));
+    while(read32(NAND_CTRL) & CTRL_FL_EXEC);
+
+    /* read only the spare, there is no ecc to check */
+    dc_invalidaterange(nand_spare_buf, SPARE_BUF_SIZE);
+    write32(NAND_CTRL, 0);
+    write32(NAND_DATA, dma_addr(nand_spare_buf));
+    write32(NAND_ECC, 0);
+    write32(NAND_CTRL,
+        CTRL_FL_EXEC |
+        nand_op_begin(NAND_OP_READ) |
+        CTRL_CMD(CMD_READ) |
+        CTRL_FL_WAIT |
+        CTRL_FL_RD |
+        CTRL_SIZE(SPARE_SIZE));
+    nand_op_wait(NAND_OP_READ);
+
+    if (read32(NAND_CTRL) & CTRL_FL_ERR) {
+        return nand_error("error executing spare read command");
+    }
+    write32(NAND_CTRL, 0);
+
+    memcpy(spare, nand_spare_buf, SPARE_SIZE);
+    return 0;
+}
+
+int nand_read_spare(u32 pageno, void *spare)
+{
+    u32 start = nand_stats_now();
+    int rc = nand_do_read_spare(pageno, spare);
+
+    nand_stats_op(nand_enabled_banks, NAND_STAT_SPARE, start);
+    return rc;
+}
+
+int nand_block_is_bad(u32 blockno)
+{
+    u8 spare[SPARE_SIZE];
+    int i;
+
+    if (blockno >= BLOCK_COUNT) {
+        return nand_error("invalid block number");
+    }
+
+    /* the factory marks bad blocks in the first or second page spare */
+    for (i = 0; i < 2; i++) {
+        if (nand_read_spare(blockno * BLOCK_PAGES + i, spare) < 0)
+            return -1;
+        if (spare[0] != 0xff)
+            return 1;
+    }
+
+    return 0;
+}
+
+int nand_scan_bad_blocks(u32 first, u32 count, u32 *bbt, int *read_errors)
+{
+    u32 b;
+    int bad = 0, errors = 0, res;
+
+    if (bbt)
+        memset(bbt, 0, ((count + 31) / 32) * sizeof(u32));
+
+    for (b = 0; b < count; b++) {
+        res = nand_block_is_bad(first + b);
+        if (res == 0)
+            continue;
+
+        /* unreadable blocks are unusable too, but not factory marked */
+        if (res < 0)
+            errors++;
+        else
+            bad++;
+
+        if (bbt)
+            bbt[b / 32] |= 1u << (b % 32);
+    }
+
+    if (read_errors)
+        *read_errors = errors;
+    return bad;
+}
+
+int nand_bg_read_start(u32 pageno, u32 count, void *buf)
+{
+    /* wait for pipelined page reads to leave the bus */
+    nand_read_complete();
+
+    if ((pageno + count) > PAGE_COUNT) {
+        return nand_error("invalid page number");
+    }
+    if ((u32)buf & 0x1f) {
+        return nand_error("unaligned page buffer");
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    nand_bg.buf = buf;
+    nand_bg.pageno = pageno;
+    nand_bg.count = count;
+    nand_bg.done = 0;
+    nand_bg.error = 0;
+
+#if NAND_IMAGE_ENABLED
+    if (nand_image_attached()) {
+        u8 *page = buf;
+        for (u32 i = 0; i < count; i++, page += PAGE_SIZE + SPARE_SIZE) {
+            if (nand_image_read_page(nand_enabled_banks, pageno + i, page, page + PAGE_SIZE) < 0) {
+                nand_bg.error = -1;
+                break;
+            }
+        }
+        nand_bg.done = count;
+        return 0;
+    }
+#endif
+
+    /* set nand config */
+    nand_set_config(0);
+
+    dc_invalidaterange(buf, count * (PAGE_SIZE + SPARE_SIZE));
+    nand_irq_clear_and_enable();
+    nand_bg.active = 1;
+    nand_bg_issue();
+
+    return 0;
+}
+
+int nand_bg_read_wait(void)
+{
+    while (nand_bg.active) {
+        u32 cookie = irq_kill();
+        if (nand_bg.active) {
+            irq_wait();
+        }
+        irq_restore(cookie);
+    }
+
+    if (nand_bg.error) {
+        nand_bg.error = 0;
+        return nand_error("error executing background page read");
+    }
+
+    write32(NAND_CTRL, 0);
+    return 0;
+}
+
+int nand_read_pages(u32 pageno, u32 count, void *data, void *spare)
+{
+    u8 *page = (u8 *)data, *page_spare = (u8 *)spare;
+    int res = 0, rc = 0, err = 0;
+    u32 i;
+
+    if ((pageno + count) > PAGE_COUNT) {
+        return nand_error("invalid page number");
+    }
+    if ((u32)data & 0x1f) {
+        return nand_error("unaligned page buffer");
+    }
+    if (nand_reads_issued != nand_reads_finished) {
+        return nand_error("page reads pending");
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    /* cache read only pays off (and 0x3f is only valid) after a 0x31 */
+    if (count == 1) {
+        return nand_read_page(pageno, data, spare);
+    }
+
+#if NAND_IMAGE_ENABLED
+    if (nand_image_attached()) {
+        for (i = 0; i < count; i++) {
+            rc = nand_read_page(pageno + i, page + i * PAGE_SIZE,
+                                page_spare ? page_spare + i * SPARE_SIZE : NULL);
+            if (rc < 0)
+                return rc;
+            res += rc;
+        }
+        return res;
+    }
+#endif
+
+    /* wait for pipelined page reads to leave the bus */
+    nand_read_complete();
+
+    /* set nand config */
+    nand_set_config(0);
+
+    /* load the first page into the chip page register */
+    write32(NAND_CTRL, 0);
+    write32(NAND_ADDR0, 0);
+    write32(NAND_ADDR1, pageno);
+    write32(NAND_CTRL,
+        CTRL_FL_EXEC |
+        CTRL_ADDR(0x1f) |
+        CTRL_CMD(CMD_READ_SETUP));
+    while(read32(NAND_CTRL) & CTRL_FL_EXEC);
+
+    write32(NAND_CTRL, 0);
+    write32(NAND_CTRL,
+        CTRL_FL_EXEC |
+        CTRL_CMD(CMD_READ) |
+        CTRL_FL_WAIT);
+    while(read32(NAND_CTRL) & CTRL_FL_EXEC);
+
+    if (read32(NAND_CTRL) & CTRL_FL_ERR) {
+        return nand_error("error executing page read command");
+    }
+
+    for (i = 0; i <= count; i++) {
+        /* stream page i out of the cache register while the chip loads
+         * the next one into its page register */
+        if (i < count) {
+            u8 *spare_buf = nand_read_spare_buf[i % NAND_READ_SLOTS];
+
+            nand_read_time[i % NAND_READ_SLOTS] = nand_stats_now();
+
+            dc_invalidaterange(page + i * PAGE_SIZE, PAGE_SIZE);
+            dc_invalidaterange(spare_buf, SPARE_BUF_SIZE);
+            write32(NAND_CTRL, 0);
+            write32(NAND_DATA, dma_addr(page + i * PAGE_SIZE));
+            write32(NAND_ECC, dma_addr(spare_buf));
+            write32(NAND_CTRL,
+                CTRL_FL_EXEC |
+                nand_op_begin(NAND_OP_CACHE_READ) |
+                CTRL_CMD(((i + 1) < count) ? CMD_CACHE_READ : CMD_CACHE_READ_END) |
+                CTRL_FL_WAIT |
+                CTRL_FL_RD |
+                CTRL_FL_ECC |
+                CTRL_SIZE(PAGE_SIZE + SPARE_SIZE));
+        }
+
+        /* meanwhile correct the previous page */
+        if ((i > 0) && !err) {
+            u8 *spare_buf = nand_read_spare_buf[(i - 1) % NAND_READ_SLOTS];
+
+            rc = nand_ecc_check(page + (i - 1) * PAGE_SIZE, spare_buf);
+            if (rc < 0)
+                err = 1;
+            else
+                res += rc;
+
+            if (page_spare)
+                memcpy(page_spare + (i - 1) * SPARE_SIZE, spare_buf, SPARE_SIZE);
+        }
+
+        if (i < count) {
+            nand_op_wait(NAND_OP_CACHE_READ);
+            nand_stats_op(nand_enabled_banks, NAND_STAT_READ, nand_read_time[i % NAND_READ_SLOTS]);
+            if (read32(NAND_CTRL) & CTRL_FL_ERR) {
+                return nand_error("error executing cache read command");
+            }
+            write32(NAND_CTRL, 0);
+            ahb_flush_from(WB_FLA);
+        }
+    }
+
+    if (err) {
+        return nand_error("uncorrectable ecc error");
     }
 
     return res;
@@ -404,6 +1040,9 @@ int nand_read_page(u32 pageno, void *data, void *spare)
 
 int nand_read_chipid(void *chipid)
 {
+    /* wait for pipelined page reads to leave the bus */
+    nand_read_complete();
+
     if ((u32)chipid & 0x1f) {
         return nand_error("unaligned chipid buffer");
     }
@@ -426,6 +1065,7 @@ int nand_read_chipid(void *chipid)
         CTRL_FL_RD | 
         CTRL_SIZE(CHIPID_BUF_SIZE));
     nand_wait_irq();
+    while(read32(NAND_CTRL) & CTRL_FL_EXEC);
 
     if (read32(NAND_CTRL) & CTRL_FL_ERR) {
         return nand_error("error executing chipid read command");
@@ -461,6 +1101,7 @@ void nand_deinitialize(void)
     /* write init config */
     write32(NAND_CONF, CONF_ATTR_INIT);
     write32(NAND_BANK, 1);
+    nand_cur_conf = nand_cur_bank = ~0;
 }
 
 void nand_initialize(void)
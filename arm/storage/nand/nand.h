@@ -18,6 +18,7 @@
 #include "common/types.h"
 
 #define NAND_WRITE_ENABLED  1
+#define NAND_IMAGE_ENABLED  0
 
 /* nand structure definitions */
 #define PAGE_SIZE           0x800
@@ -50,16 +51,62 @@ int nand_read_chipid(void *chipid);
 /* read page and spare */
 int nand_read_page(u32 pageno, void *data, void *spare);
 
+/* pipelined page reads: start a read while the previous one is being
+ * processed, then finish reads (ecc correction) in the order they were
+ * started; at most two reads can be pending at a time */
+int nand_read_page_start(u32 pageno, void *data);
+int nand_read_page_finish(void *data, void *spare);
+
+/* drop all pending page reads */
+void nand_read_abort(void);
+
+/* read only the spare of a page, without ecc checks */
+int nand_read_spare(u32 pageno, void *spare);
+
+/* check the factory bad block marker of a block, 1 if bad */
+int nand_block_is_bad(u32 blockno);
+
+/* check count blocks of the enabled bank from first, optionally building
+ * a table (one bit per block, relative to first) of the unusable ones;
+ * returns the number of factory bad blocks, unreadable blocks are
+ * counted separately in read_errors (optional) */
+int nand_scan_bad_blocks(u32 first, u32 count, u32 *bbt, int *read_errors);
+
+/* read raw pages (each followed by its spare, no ecc checks) in the
+ * background; the nand irq handler chains the reads so the cpu is free
+ * until nand_bg_read_wait, no other nand operation may be issued meanwhile */
+int nand_bg_read_start(u32 pageno, u32 count, void *buf);
+int nand_bg_read_wait(void);
+
+/* read consecutive pages and their spares (optional, SPARE_SIZE each)
+ * using the chip cache read mode, no pipelined reads may be pending;
+ * returns the number of pages that needed ecc correction */
+int nand_read_pages(u32 pageno, u32 count, void *data, void *spare);
+
 #if NAND_WRITE_ENABLED
 /* write page and spare */
 int nand_write_page(u32 pageno, void *data, void *spare);
 
+/* write consecutive pages and their spares (optional, SPARE_SIZE each)
+ * using the chip cache program mode */
+int nand_write_pages(u32 pageno, u32 count, void *data, void *spare);
+
 /* erase a block of pages */
 int nand_erase_block(u32 blockno);
 #endif
 
-/* set enabled nand banks */
-void nand_enable_banks(u32 bank);
+/* set enabled nand banks, the controller is only reconfigured
+ * when the bank or write protection actually change; switching
+ * to another bank inside a batch fails */
+int nand_enable_banks(u32 bank);
+
+/* group operations on one bank: the bank is selected once and, when
+ * write_enable is set, write protection stays off until the end, which
+ * selects the previous bank again; batches nest, but a nested batch on
+ * another bank or asking for writes inside a read only batch fails
+ * (it still has to be ended) */
+int nand_batch_begin(u32 bank, int write_enable);
+void nand_batch_end(void);
 
 /* nand irq handler */
 void nand_irq(void);
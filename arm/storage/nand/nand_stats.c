@@ -0,0 +1,149 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "nand_stats.h"
+#include "nand.h"
+#include "storage/sd/fatfs/ff.h"
+#include <stdio.h>
+#include <string.h>
+
+/* LT_TIMER runs at ~1.898 MHz */
+#define TICKS2US(x)     ((u32)(((u64)(x) * 1000) / 1898))
+
+static nand_bank_stats nand_stats[4];
+
+static const char *nand_stat_names[NAND_STAT_OPS] = {
+    [NAND_STAT_READ]    = "read",
+    [NAND_STAT_SPARE]   = "spare read",
+    [NAND_STAT_PROGRAM] = "program",
+    [NAND_STAT_ERASE]   = "erase",
+    [NAND_STAT_ECC]     = "ecc",
+};
+
+static const char *nand_event_names[NAND_EV_COUNT] = {
+    [NAND_EV_ECC_CORRECTED]     = "ecc corrected pages",
+    [NAND_EV_ECC_UNCORRECTABLE] = "uncorrectable pages",
+    [NAND_EV_PROGRAM_FAIL]      = "program failures",
+    [NAND_EV_ERASE_FAIL]        = "erase failures",
+    [NAND_EV_ECC_BITS]          = "ecc corrected bits",
+};
+
+void nand_stats_op(u32 bank, int op, u32 start)
+{
+    nand_op_stats *stats = &nand_stats[bank & 3].ops[op];
+    u32 ticks = nand_stats_now() - start;
+    int bucket = 0;
+
+    while ((bucket < (NAND_STATS_BUCKETS - 1)) && (ticks >> (bucket + 1)))
+        bucket++;
+
+    stats->count++;
+    stats->total += ticks;
+    stats->max = max(stats->max, ticks);
+    stats->hist[bucket]++;
+}
+
+void nand_stats_event(u32 bank, int event)
+{
+    nand_stats[bank & 3].events[event]++;
+}
+
+void nand_stats_add(u32 bank, int event, u32 count)
+{
+    nand_stats[bank & 3].events[event] += count;
+}
+
+void nand_stats_ecc(u32 bank, const s8 *bits)
+{
+    for (int i = 0; i < ECC_SUBPAGES; i++)
+        if (bits[i] > 0)
+            nand_stats[bank & 3].ecc_subpage_bits[i] += bits[i];
+}
+
+const nand_bank_stats *nand_stats_get(u32 bank)
+{
+    return &nand_stats[bank & 3];
+}
+
+void nand_stats_reset(void)
+{
+    memset(nand_stats, 0, sizeof(nand_stats));
+}
+
+static void nand_stats_dump(void (*emit)(const char *line, void *arg), void *arg)
+{
+    static const struct { u32 bank; const char *name; } banks[] = {
+        { BANK_SLC, "slc" },
+        { BANK_SLCCMPT, "slccmpt" },
+    };
+    char line[0x80];
+    int i, op, b;
+
+    for (i = 0; i < (int)(sizeof(banks) / sizeof(banks[0])); i++) {
+        const nand_bank_stats *stats = &nand_stats[banks[i].bank];
+
+        snprintf(line, sizeof(line), "%s:\n", banks[i].name);
+        emit(line, arg);
+
+        for (op = 0; op < NAND_STAT_OPS; op++) {
+            const nand_op_stats *s = &stats->ops[op];
+            if (!s->count)
+                continue;
+
+            snprintf(line, sizeof(line), "  %-10s %8lu ops, avg %lu us, max %lu us\n",
+                     nand_stat_names[op], s->count,
+                     TICKS2US(s->total / s->count), TICKS2US(s->max));
+            emit(line, arg);
+
+            for (b = 0; b < NAND_STATS_BUCKETS; b++) {
+                if (!s->hist[b])
+                    continue;
+                snprintf(line, sizeof(line), "    %6lu - %6lu us: %lu\n",
+                         TICKS2US(1ull << b), TICKS2US(2ull << b), s->hist[b]);
+                emit(line, arg);
+            }
+        }
+
+        for (op = 0; op < NAND_EV_COUNT; op++) {
+            snprintf(line, sizeof(line), "  %s: %lu\n", nand_event_names[op], stats->events[op]);
+            emit(line, arg);
+        }
+
+        /* a weak spot shows up as one subpage collecting most of the bits */
+        snprintf(line, sizeof(line), "  ecc bits by subpage: %lu %lu %lu %lu\n",
+                 stats->ecc_subpage_bits[0], stats->ecc_subpage_bits[1],
+                 stats->ecc_subpage_bits[2], stats->ecc_subpage_bits[3]);
+        emit(line, arg);
+    }
+}
+
+static void nand_stats_emit_console(const char *line, void *arg)
+{
+    fputs(line, stdout);
+}
+
+static void nand_stats_emit_file(const char *line, void *arg)
+{
+    f_puts(line, (FIL *)arg);
+}
+
+void nand_stats_print(void)
+{
+    nand_stats_dump(nand_stats_emit_console, NULL);
+}
+
+int nand_stats_save(const char *path)
+{
+    FIL fil;
+
+    if (f_open(&fil, path, FA_WRITE | FA_CREATE_ALWAYS))
+        return -1;
+
+    nand_stats_dump(nand_stats_emit_file, &fil);
+    f_close(&fil);
+    return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef __NAND_STATS_H__
+#define __NAND_STATS_H__
+
+#include "common/types.h"
+#include "system/latte.h"
+#include "common/utils.h"
+#include "ecc.h"
+
+/* timed operations */
+#define NAND_STAT_READ          0 // page read, issue to data in memory
+#define NAND_STAT_SPARE         1 // spare only read
+#define NAND_STAT_PROGRAM       2 // page transfer and program
+#define NAND_STAT_ERASE         3 // block erase
+#define NAND_STAT_ECC           4 // ecc check and correction of a page
+#define NAND_STAT_OPS           5
+
+/* counted events */
+#define NAND_EV_ECC_CORRECTED       0
+#define NAND_EV_ECC_UNCORRECTABLE   1
+#define NAND_EV_PROGRAM_FAIL        2
+#define NAND_EV_ERASE_FAIL          3
+#define NAND_EV_ECC_BITS            4
+#define NAND_EV_COUNT               5
+
+/* one bucket per power of two timer ticks */
+#define NAND_STATS_BUCKETS      32
+
+typedef struct nand_op_stats {
+    u32 count;
+    u64 total;
+    u32 max;
+    u32 hist[NAND_STATS_BUCKETS];
+} nand_op_stats;
+
+typedef struct nand_bank_stats {
+    nand_op_stats ops[NAND_STAT_OPS];
+    u32 events[NAND_EV_COUNT];
+    u32 ecc_subpage_bits[ECC_SUBPAGES]; // corrected bits by position in the page
+} nand_bank_stats;
+
+static inline u32 nand_stats_now(void)
+{
+    return read32(LT_TIMER);
+}
+
+/* account an operation started at the given timer value */
+void nand_stats_op(u32 bank, int op, u32 start);
+void nand_stats_event(u32 bank, int event);
+void nand_stats_add(u32 bank, int event, u32 count);
+/* account the per subpage result of an ecc correction */
+void nand_stats_ecc(u32 bank, const s8 *bits);
+
+const nand_bank_stats *nand_stats_get(u32 bank);
+void nand_stats_reset(void);
+
+/* dump all statistics to the console or to a file on the sd card */
+void nand_stats_print(void);
+int nand_stats_save(const char *path);
+
+#endif
@@ -105,10 +105,15 @@ DRESULT disk_write (
 
     while(count) {
         u32 work = min(count, SDHC_BLOCK_COUNT_MAX);
+        const BYTE *src = buff;
 
-        memcpy(buffer, buff, work * SDMMC_DEFAULT_BLOCKLEN);
+        /* aligned data can be sent without the bounce buffer */
+        if((u32)buff & 0x1f) {
+            memcpy(buffer, buff, work * SDMMC_DEFAULT_BLOCKLEN);
+            src = buffer;
+        }
 
-        if(sdcard_write(sector, work, buffer) != 0)
+        if(sdcard_write(sector, work, (void*)src) != 0)
             return RES_ERROR;
 
         sector += work;
@@ -16,6 +16,7 @@
 #include "latte.h"
 #include "common/utils.h"
 #include "crypto/crypto.h"
+#include "crypto/aes.h"
 #include "storage/nand/nand.h"
 #include "storage/sd/sdcard.h"
 #include <stdio.h>
@@ -98,6 +99,7 @@ void irq_handler(void)
     if(all_mask & IRQF_AES) {
 //      printf("IRQ: AES\n");
         write32(LT_INTSR_AHBALL_ARM, IRQF_AES);
+        aes_irq();
     }
     if(all_mask & IRQF_SD0) {
 //      printf("IRQ: SD0\n");